@@ -0,0 +1,196 @@
+#ifndef ASYNC_TEXTURE_LOADER_H
+#define ASYNC_TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <loader/texture_cache.hpp>
+#include <utils/thread_pool.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+// decodes textures on worker threads and uploads them from the render thread under a per-frame budget.
+// load() returns at once with a texture showing a placeholder texel, the same GL name receives
+// the real image once update() gets to it, so callers never have to rebind anything.
+class AsyncTextureLoader
+{
+public:
+    explicit AsyncTextureLoader(ThreadPool &pool = ThreadPool::shared());
+    ~AsyncTextureLoader();
+    AsyncTextureLoader(const AsyncTextureLoader &) = delete;
+    AsyncTextureLoader &operator=(const AsyncTextureLoader &) = delete;
+
+    TextureHandle load(const std::string &path, const TextureOptions &options = TextureOptions());
+    // upload decoded images on the context thread until either budget is spent, returns the upload count.
+    // one image is always uploaded when available, so a single large image can not stall forever.
+    unsigned int update(double budgetMilliseconds = 2.0, size_t budgetBytes = 16 * 1024 * 1024);
+    // number of textures still decoding or waiting for upload
+    size_t pending() const;
+    void waitIdle();
+
+private:
+    struct DecodedImage
+    {
+        TextureHandle texture;
+        TextureOptions options;
+        std::string path;
+        uint64_t contentHash;
+        unsigned char *pixels;
+        int width;
+        int height;
+        int nrComponents;
+        // set instead of pixels when a precompressed sibling was found
+        std::shared_ptr<Ktx2Image> compressed;
+    };
+
+    ThreadPool &pool;
+    mutable std::mutex mutex;
+    std::condition_variable decodedCondition;
+    std::deque<DecodedImage> decoded;
+    size_t decoding;
+
+    void decode(DecodedImage image);
+};
+
+AsyncTextureLoader::AsyncTextureLoader(ThreadPool &pool) : pool(pool), decoding(0)
+{
+}
+
+AsyncTextureLoader::~AsyncTextureLoader()
+{
+    // workers reference this loader, wait for them before the images are dropped
+    std::unique_lock<std::mutex> lock(mutex);
+    decodedCondition.wait(lock, [this]()
+                          { return decoding == 0; });
+    for (DecodedImage &image : decoded)
+    {
+        stbi_image_free(image.pixels);
+    }
+}
+
+TextureHandle AsyncTextureLoader::load(const std::string &path, const TextureOptions &options)
+{
+    bool created = false;
+    TextureHandle texture = TextureCache::instance().reserve(path, options, created);
+    if (!created)
+    {
+        return texture;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoding++;
+    }
+    // queried here because the format support check needs the context, workers only read the result
+    compressedFormatSupport();
+    DecodedImage image{texture, options, path, 0, nullptr, 0, 0, 0, nullptr};
+    pool.submit([this, image]()
+                { decode(image); });
+    return texture;
+}
+
+void AsyncTextureLoader::decode(DecodedImage image)
+{
+    auto compressed = std::make_shared<Ktx2Image>();
+    if (TextureCache::readCompressedSibling(image.path, image.options, compressedFormatSupport(), *compressed, image.contentHash))
+    {
+        image.compressed = compressed;
+    }
+    else
+    {
+        std::vector<unsigned char> bytes;
+        if (TextureCache::readFile(image.path, bytes))
+        {
+            image.contentHash = fnv1aHash(bytes.data(), bytes.size());
+            image.pixels = decodeImage(bytes, image.options.flipVertically, image.width, image.height, image.nrComponents);
+        }
+        if (!image.pixels)
+        {
+            std::cout << "Texture failed to load at path: " << image.path << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // failed images are dropped here and keep showing the placeholder
+    if (image.pixels || image.compressed)
+    {
+        decoded.push_back(std::move(image));
+    }
+    decoding--;
+    decodedCondition.notify_all();
+}
+
+unsigned int AsyncTextureLoader::update(double budgetMilliseconds, size_t budgetBytes)
+{
+    const auto start = std::chrono::steady_clock::now();
+    size_t uploadedBytes = 0;
+    unsigned int uploads = 0;
+
+    while (true)
+    {
+        DecodedImage image;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (decoded.empty())
+            {
+                break;
+            }
+            const DecodedImage &next = decoded.front();
+            const size_t imageBytes = next.compressed ? next.compressed->data.size()
+                                                      : size_t(next.width) * next.height * next.nrComponents;
+            if (uploads > 0 && uploadedBytes + imageBytes > budgetBytes)
+            {
+                break;
+            }
+            image = std::move(decoded.front());
+            decoded.pop_front();
+            uploadedBytes += imageBytes;
+        }
+
+        if (image.compressed)
+        {
+            TextureCache::instance().fulfil(image.texture, image.options, image.contentHash, *image.compressed);
+        }
+        else
+        {
+            TextureCache::instance().fulfil(image.texture, image.options, image.contentHash,
+                                            image.pixels, image.width, image.height, image.nrComponents);
+            stbi_image_free(image.pixels);
+        }
+        uploads++;
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= budgetMilliseconds)
+        {
+            break;
+        }
+    }
+    return uploads;
+}
+
+size_t AsyncTextureLoader::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return decoding + decoded.size();
+}
+
+void AsyncTextureLoader::waitIdle()
+{
+    while (true)
+    {
+        update(1e9, SIZE_MAX);
+        std::unique_lock<std::mutex> lock(mutex);
+        if (decoding == 0 && decoded.empty())
+        {
+            return;
+        }
+        decodedCondition.wait(lock, [this]()
+                              { return decoding == 0 || !decoded.empty(); });
+    }
+}
+
+#endif
@@ -66,6 +66,27 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // returns the perspective projection for the current Zoom
+    glm::mat4 GetProjectionMatrix(float aspect, float zNear = 0.1f, float zFar = 100.0f)
+    {
+        return glm::perspective(glm::radians(Zoom), aspect, zNear, zFar);
+    }
+
+    // returns the projection of one tile of an imageWidth x imageHeight image, the pixel rectangle starting at x, y
+    // (bottom left, like glViewport). it is GetProjectionMatrix's frustum cut down to the tile, so rendering every
+    // tile into its own viewport and putting them side by side gives exactly the image rendered in one piece
+    glm::mat4 GetTileProjectionMatrix(unsigned int imageWidth, unsigned int imageHeight, unsigned int x, unsigned int y,
+                                      unsigned int tileWidth, unsigned int tileHeight, float zNear = 0.1f, float zFar = 100.0f)
+    {
+        float top = zNear * tan(glm::radians(Zoom) / 2.0f);
+        float right = top * (float)imageWidth / (float)imageHeight;
+        float tileLeft = -right + 2.0f * right * x / imageWidth;
+        float tileRight = -right + 2.0f * right * (x + tileWidth) / imageWidth;
+        float tileBottom = -top + 2.0f * top * y / imageHeight;
+        float tileTop = -top + 2.0f * top * (y + tileHeight) / imageHeight;
+        return glm::frustum(tileLeft, tileRight, tileBottom, tileTop, zNear, zFar);
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
@@ -0,0 +1,352 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// the loader is generated for core 4.1 without extensions, so the S3TC/BPTC enums are declared here
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+// vkFormat values of the block compressed formats we read and write
+enum EKtx2Format
+{
+    EKtx2Format_BC1_RGB_UNORM = 131,
+    EKtx2Format_BC1_RGB_SRGB = 132,
+    EKtx2Format_BC1_RGBA_UNORM = 133,
+    EKtx2Format_BC1_RGBA_SRGB = 134,
+    EKtx2Format_BC3_UNORM = 137,
+    EKtx2Format_BC3_SRGB = 138,
+    EKtx2Format_BC5_UNORM = 141,
+    EKtx2Format_BC7_UNORM = 145,
+    EKtx2Format_BC7_SRGB = 146,
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+const size_t KTX2_HEADER_SIZE = 80;
+const size_t KTX2_LEVEL_INDEX_ENTRY_SIZE = 24;
+
+struct Ktx2Level
+{
+    size_t offset;
+    size_t size;
+    int width;
+    int height;
+};
+
+// a 2D block compressed texture, levels[0] is the full resolution image
+struct Ktx2Image
+{
+    uint32_t vkFormat;
+    int width;
+    int height;
+    std::vector<Ktx2Level> levels;
+    std::vector<unsigned char> data;
+};
+
+struct CompressedFormatSupport
+{
+    bool s3tc;
+    bool rgtc;
+    bool bptc;
+};
+
+unsigned int ktx2BlockBytes(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+    case EKtx2Format_BC1_RGB_UNORM:
+    case EKtx2Format_BC1_RGB_SRGB:
+    case EKtx2Format_BC1_RGBA_UNORM:
+    case EKtx2Format_BC1_RGBA_SRGB:
+        return 8;
+    case EKtx2Format_BC3_UNORM:
+    case EKtx2Format_BC3_SRGB:
+    case EKtx2Format_BC5_UNORM:
+    case EKtx2Format_BC7_UNORM:
+    case EKtx2Format_BC7_SRGB:
+        return 16;
+    }
+    return 0;
+}
+
+GLenum ktx2InternalFormat(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+    case EKtx2Format_BC1_RGB_UNORM:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case EKtx2Format_BC1_RGB_SRGB:
+        return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    case EKtx2Format_BC1_RGBA_UNORM:
+        return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    case EKtx2Format_BC1_RGBA_SRGB:
+        return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+    case EKtx2Format_BC3_UNORM:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case EKtx2Format_BC3_SRGB:
+        return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    case EKtx2Format_BC5_UNORM:
+        return GL_COMPRESSED_RG_RGTC2;
+    case EKtx2Format_BC7_UNORM:
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    case EKtx2Format_BC7_SRGB:
+        return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    }
+    return 0;
+}
+
+// uncompressed format with the same channels, reported to callers that ask for the texture format
+GLenum ktx2BaseFormat(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+    case EKtx2Format_BC1_RGB_UNORM:
+    case EKtx2Format_BC1_RGB_SRGB:
+        return GL_RGB;
+    case EKtx2Format_BC5_UNORM:
+        return GL_RG;
+    }
+    return GL_RGBA;
+}
+
+// first call has to happen on the thread owning the context, later calls are safe from anywhere
+const CompressedFormatSupport &compressedFormatSupport()
+{
+    static const CompressedFormatSupport support = []()
+    {
+        CompressedFormatSupport result{false, true, false};
+        GLint major = 0, minor = 0, count = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        result.bptc = major > 4 || (major == 4 && minor >= 2);
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+            if (!name)
+                continue;
+            if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+                result.s3tc = true;
+            else if (strcmp(name, "GL_ARB_texture_compression_bptc") == 0)
+                result.bptc = true;
+        }
+        return result;
+    }();
+    return support;
+}
+
+bool ktx2FormatSupported(uint32_t vkFormat, const CompressedFormatSupport &support)
+{
+    switch (vkFormat)
+    {
+    case EKtx2Format_BC5_UNORM:
+        return support.rgtc;
+    case EKtx2Format_BC7_UNORM:
+    case EKtx2Format_BC7_SRGB:
+        return support.bptc;
+    }
+    return ktx2BlockBytes(vkFormat) != 0 && support.s3tc;
+}
+
+// "dir/name.png" -> "dir/name.ktx2"
+std::string ktx2SiblingPath(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return path + ".ktx2";
+    }
+    return path.substr(0, dot) + ".ktx2";
+}
+
+size_t ktx2LevelSize(uint32_t vkFormat, int width, int height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * ktx2BlockBytes(vkFormat);
+}
+
+template <typename T>
+T readKtx2Field(const std::vector<unsigned char> &bytes, size_t offset)
+{
+    T value;
+    memcpy(&value, bytes.data() + offset, sizeof(T));
+    return value;
+}
+
+// accepts plain (not supercompressed) single layer 2D textures in one of the formats above
+bool readKtx2(std::vector<unsigned char> bytes, Ktx2Image &image)
+{
+    if (bytes.size() < KTX2_HEADER_SIZE || memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+    {
+        return false;
+    }
+
+    image.vkFormat = readKtx2Field<uint32_t>(bytes, 12);
+    image.width = static_cast<int>(readKtx2Field<uint32_t>(bytes, 20));
+    image.height = static_cast<int>(readKtx2Field<uint32_t>(bytes, 24));
+    uint32_t depth = readKtx2Field<uint32_t>(bytes, 28);
+    uint32_t layerCount = readKtx2Field<uint32_t>(bytes, 32);
+    uint32_t faceCount = readKtx2Field<uint32_t>(bytes, 36);
+    uint32_t levelCount = std::max(1u, readKtx2Field<uint32_t>(bytes, 40));
+    uint32_t supercompression = readKtx2Field<uint32_t>(bytes, 44);
+    if (ktx2BlockBytes(image.vkFormat) == 0 || image.width <= 0 || image.height <= 0 ||
+        depth != 0 || layerCount > 1 || faceCount != 1 || supercompression != 0 || levelCount > 32 ||
+        KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE > bytes.size())
+    {
+        return false;
+    }
+
+    image.levels.clear();
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        size_t entry = KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+        Ktx2Level level;
+        level.offset = static_cast<size_t>(readKtx2Field<uint64_t>(bytes, entry));
+        level.size = static_cast<size_t>(readKtx2Field<uint64_t>(bytes, entry + 8));
+        level.width = std::max(1, image.width >> i);
+        level.height = std::max(1, image.height >> i);
+        if (level.size != ktx2LevelSize(image.vkFormat, level.width, level.height) ||
+            level.offset > bytes.size() || level.size > bytes.size() - level.offset)
+        {
+            return false;
+        }
+        image.levels.push_back(level);
+    }
+
+    image.data = std::move(bytes);
+    return true;
+}
+
+// write a KTX2 file with a basic data format descriptor, levels[0] is the full resolution image
+bool writeKtx2(const std::string &path, uint32_t vkFormat, int width, int height, const std::vector<std::vector<uint8_t>> &levels)
+{
+    const unsigned int blockBytes = ktx2BlockBytes(vkFormat);
+    if (blockBytes == 0 || levels.empty())
+    {
+        return false;
+    }
+
+    // data format descriptor: one basic block, one sample per 64-bit half of the block
+    uint8_t colorModel = 128; // KHR_DF_MODEL_BC1A
+    std::vector<std::pair<uint8_t, uint8_t>> samples = {{0, 0}};
+    bool srgb = false;
+    switch (vkFormat)
+    {
+    case EKtx2Format_BC1_RGB_SRGB:
+    case EKtx2Format_BC1_RGBA_SRGB:
+        srgb = true;
+        break;
+    case EKtx2Format_BC3_SRGB:
+        srgb = true;
+        // fall through
+    case EKtx2Format_BC3_UNORM:
+        colorModel = 130; // KHR_DF_MODEL_BC3
+        samples = {{0, 15}, {64, 0}};
+        break;
+    case EKtx2Format_BC5_UNORM:
+        colorModel = 132; // KHR_DF_MODEL_BC5
+        samples = {{0, 0}, {64, 1}};
+        break;
+    case EKtx2Format_BC7_SRGB:
+        srgb = true;
+        // fall through
+    case EKtx2Format_BC7_UNORM:
+        colorModel = 134; // KHR_DF_MODEL_BC7
+        samples = {{0, 0}};
+        break;
+    }
+    const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+    std::vector<uint8_t> dfd(4 + blockSize, 0);
+    uint32_t dfdTotal = static_cast<uint32_t>(dfd.size());
+    uint32_t versionAndSize = 2 | (blockSize << 16);
+    memcpy(&dfd[0], &dfdTotal, 4);
+    memcpy(&dfd[8], &versionAndSize, 4);
+    dfd[12] = colorModel;
+    dfd[13] = 1;            // BT.709 primaries
+    dfd[14] = srgb ? 2 : 1; // sRGB or linear transfer
+    dfd[16] = 3;            // 4x4 texel blocks
+    dfd[17] = 3;
+    dfd[20] = static_cast<uint8_t>(blockBytes);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        uint8_t *sample = &dfd[28 + 16 * i];
+        uint16_t bitOffset = samples[i].first;
+        uint32_t upper = 0xFFFFFFFF;
+        memcpy(sample, &bitOffset, 2);
+        sample[2] = blockBytes == 8 ? 63 : static_cast<uint8_t>(samples.size() == 1 ? 127 : 63);
+        sample[3] = samples[i].second;
+        memcpy(sample + 12, &upper, 4);
+    }
+
+    // level data is stored smallest level first, every level aligned to the block size
+    const size_t levelIndexEnd = KTX2_HEADER_SIZE + levels.size() * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    const size_t dfdOffset = levelIndexEnd;
+    std::vector<uint64_t> offsets(levels.size());
+    size_t offset = dfdOffset + dfd.size();
+    for (size_t i = levels.size(); i-- > 0;)
+    {
+        offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+        offsets[i] = offset;
+        offset += levels[i].size();
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    memcpy(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    uint32_t header[9] = {vkFormat, 1, static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, 0, 1,
+                          static_cast<uint32_t>(levels.size()), 0};
+    memcpy(&file[12], header, sizeof(header));
+    uint32_t dfdIndex[2] = {static_cast<uint32_t>(dfdOffset), static_cast<uint32_t>(dfd.size())};
+    memcpy(&file[48], dfdIndex, sizeof(dfdIndex));
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        uint64_t entry[3] = {offsets[i], levels[i].size(), levels[i].size()};
+        memcpy(&file[KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_ENTRY_SIZE], entry, sizeof(entry));
+        memcpy(&file[offsets[i]], levels[i].data(), levels[i].size());
+    }
+    memcpy(&file[dfdOffset], dfd.data(), dfd.size());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    return static_cast<bool>(out);
+}
+
+// upload every level of a compressed image into the currently generated texture id
+void uploadCompressedTexture2D(unsigned int id, const Ktx2Image &image, GLenum wrapS, GLenum wrapT)
+{
+    const GLenum internalFormat = ktx2InternalFormat(image.vkFormat);
+    glBindTexture(GL_TEXTURE_2D, id);
+    for (size_t i = 0; i < image.levels.size(); i++)
+    {
+        const Ktx2Level &level = image.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), internalFormat, level.width, level.height, 0,
+                               static_cast<GLsizei>(level.size), image.data.data() + level.offset);
+    }
+    // the stored chain may stop early, never sample past it
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+#endif
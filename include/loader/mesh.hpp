@@ -33,30 +33,50 @@ class Mesh
 {
 public:
     unsigned int VAO;
+    unsigned int vertexCount;
+    unsigned int indexCount;
 
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
 
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
+    // upload straight from caller-owned memory (e.g. a mapped mesh cache), vertices/indices stay empty
+    Mesh(const Vertex *vertexData, unsigned int vertexCount, const unsigned int *indexData, unsigned int indexCount, vector<Texture> textures);
     void Draw(Shader &shader);
 
 private:
     unsigned int VBO, EBO;
+    // "material.texture_diffuse1" etc. for every texture, built once instead of on every draw
+    vector<string> samplerNames;
 
-    void setupMesh();
+    void setupMesh(const Vertex *vertexData, const unsigned int *indexData);
+    void setupSamplerNames();
 };
 
 Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
 {
-    this->vertices = vertices;
-    this->indices = indices;
+    this->vertices = std::move(vertices);
+    this->indices = std::move(indices);
+    this->textures = std::move(textures);
+    this->vertexCount = static_cast<unsigned int>(this->vertices.size());
+    this->indexCount = static_cast<unsigned int>(this->indices.size());
+
+    setupMesh(this->vertices.data(), this->indices.data());
+    setupSamplerNames();
+}
+
+Mesh::Mesh(const Vertex *vertexData, unsigned int vertexCount, const unsigned int *indexData, unsigned int indexCount, vector<Texture> textures)
+{
     this->textures = textures;
+    this->vertexCount = vertexCount;
+    this->indexCount = indexCount;
 
-    setupMesh();
+    setupMesh(vertexData, indexData);
+    setupSamplerNames();
 }
 
-void Mesh::setupMesh()
+void Mesh::setupMesh(const Vertex *vertexData, const unsigned int *indexData)
 {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -65,10 +85,10 @@ void Mesh::setupMesh()
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
     // vertex positions
     glEnableVertexAttribArray(0);
@@ -83,15 +103,14 @@ void Mesh::setupMesh()
     glBindVertexArray(0);
 }
 
-void Mesh::Draw(Shader &shader)
+void Mesh::setupSamplerNames()
 {
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
 
+    samplerNames.clear();
     for (unsigned int i = 0; i < textures.size(); i++)
     {
-        glActiveTexture(GL_TEXTURE0 + i);
-
         string number;
         string name = textures[i].type;
         if (name == "texture_diffuse")
@@ -102,14 +121,23 @@ void Mesh::Draw(Shader &shader)
         {
             number = std::to_string(specularNr++);
         }
-        shader.setInt(("material." + name + number).c_str(), i);
+        samplerNames.push_back("material." + name + number);
+    }
+}
+
+void Mesh::Draw(Shader &shader)
+{
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        shader.setInt(samplerNames[i], i);
         glBindTexture(GL_TEXTURE_2D, textures[i].id);
     }
     glActiveTexture(GL_TEXTURE0);
 
     // draw mesh
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 }
 
@@ -1,37 +1,98 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#ifndef STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_IMPLEMENTATION
-#include <loader/stb_image.h>
-#endif
-
 #include <loader/mesh.hpp>
+#include <loader/texture_cache.hpp>
+#include <loader/async_texture_loader.hpp>
+#include <utils/hash.hpp>
+#include <utils/mapped_file.hpp>
+#include <utils/thread_pool.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <unordered_map>
 
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// binary mesh cache written next to the source asset, bump the version whenever the layout changes
+const char MODEL_CACHE_MAGIC[4] = {'L', 'G', 'M', 'C'};
+const uint32_t MODEL_CACHE_VERSION = 1;
+const char *const MODEL_CACHE_EXTENSION = ".meshcache";
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+// file layout: header, one record per mesh, all vertex arrays, all index arrays, texture lists.
+// every section size is a multiple of 4 so the mapped arrays can be handed to GL as is.
+struct ModelCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t importFlags;
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    uint32_t reserved;
+};
+
+struct ModelCacheMesh
+{
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t textureOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureCount;
+    uint32_t reserved;
+};
+
+// material texture that has not been turned into a GL texture yet
+struct TextureRef
+{
+    string type;
+    string path;
+};
+
+// output of the cpu stage of loading, everything needed to build a Mesh on the context thread
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<TextureRef> textures;
+};
+
 class Model
 {
 private:
     string directory;
     bool gammaCorrection;
+    bool useCache;
+    AsyncTextureLoader *textureLoader;
 
     void loadModel(string path);
-    void processNode(aiNode *node, const aiScene *scene);
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene);
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName);
+    bool loadCache(const string &cachePath, uint64_t sourceHash);
+    void writeCache(const string &cachePath, uint64_t sourceHash);
+    void processNode(aiNode *node, const aiScene *scene, vector<aiMesh *> &sceneMeshes);
+    static MeshData processMesh(const aiMesh *mesh, const aiScene *scene);
+    static void collectMaterialTextures(const aiMaterial *mat, aiTextureType type, const string &typeName, vector<TextureRef> &textures);
+    Texture loadMaterialTexture(const string &path, const string &typeName);
+
+    // keeps the cached GL textures of this model alive, indexed like textures_loaded
+    vector<TextureHandle> textureHandles;
+    unordered_map<string, size_t> textureIndex;
 
 public:
     vector<Mesh> meshes;
     vector<Texture> textures_loaded;
 
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // with a textureLoader the model is drawable right away, its textures stream in as textureLoader->update() uploads them
+    Model(string const &path, bool gamma = false, bool cache = true, AsyncTextureLoader *textureLoader = nullptr)
+        : gammaCorrection(gamma), useCache(cache), textureLoader(textureLoader)
     {
         loadModel(path);
     }
@@ -40,120 +101,301 @@ public:
 
 void Model::loadModel(string path)
 {
+    directory = path.substr(0, path.find_last_of('/'));
+
+    // a cache built from a different source file is ignored and rewritten below
+    string cachePath = path + MODEL_CACHE_EXTENSION;
+    uint64_t sourceHash = 0;
+    bool hashed = useCache && hashFile(path, sourceHash);
+    if (hashed && loadCache(cachePath, sourceHash))
+    {
+        return;
+    }
+
     Assimp::Importer import;
-    const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    const aiScene *scene = import.ReadFile(path, MODEL_IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
     {
         cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
         return;
     }
-    directory = path.substr(0, path.find_last_of('/'));
 
-    processNode(scene->mRootNode, scene);
+    vector<aiMesh *> sceneMeshes;
+    processNode(scene->mRootNode, scene, sceneMeshes);
+
+    // cpu stage: convert every mesh on the shared pool, the scene is only read from here on
+    vector<MeshData> meshData(sceneMeshes.size());
+    vector<future<void>> pending;
+    pending.reserve(sceneMeshes.size());
+    for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+    {
+        pending.push_back(ThreadPool::shared().submit([&, i]()
+                                                      { meshData[i] = processMesh(sceneMeshes[i], scene); }));
+    }
+    for (future<void> &task : pending)
+    {
+        task.get();
+    }
+
+    // gl stage: buffers and textures have to be created on the thread owning the context
+    meshes.reserve(meshData.size());
+    for (MeshData &data : meshData)
+    {
+        vector<Texture> textures;
+        textures.reserve(data.textures.size());
+        for (const TextureRef &ref : data.textures)
+        {
+            textures.push_back(loadMaterialTexture(ref.path, ref.type));
+        }
+        meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices), std::move(textures)));
+    }
+
+    if (hashed)
+    {
+        writeCache(cachePath, sourceHash);
+    }
+}
+
+bool Model::loadCache(const string &cachePath, uint64_t sourceHash)
+{
+    MappedFile file;
+    if (!file.open(cachePath.c_str()) || file.size() < sizeof(ModelCacheHeader))
+    {
+        return false;
+    }
+
+    const uint8_t *base = file.data();
+    const uint64_t size = file.size();
+    const ModelCacheHeader *header = reinterpret_cast<const ModelCacheHeader *>(base);
+    if (memcmp(header->magic, MODEL_CACHE_MAGIC, sizeof(MODEL_CACHE_MAGIC)) != 0 ||
+        header->version != MODEL_CACHE_VERSION ||
+        header->sourceHash != sourceHash ||
+        header->importFlags != MODEL_IMPORT_FLAGS ||
+        header->vertexStride != sizeof(Vertex))
+    {
+        return false;
+    }
+    if (sizeof(ModelCacheHeader) + uint64_t(header->meshCount) * sizeof(ModelCacheMesh) > size)
+    {
+        return false;
+    }
+    const ModelCacheMesh *records = reinterpret_cast<const ModelCacheMesh *>(base + sizeof(ModelCacheHeader));
+
+    // validate the whole file before creating any GL object, so a truncated cache falls back cleanly
+    vector<vector<TextureRef>> materials(header->meshCount);
+    for (unsigned int i = 0; i < header->meshCount; i++)
+    {
+        const ModelCacheMesh &record = records[i];
+        if (record.vertexOffset % 4 != 0 || record.indexOffset % 4 != 0 ||
+            record.vertexOffset + uint64_t(record.vertexCount) * sizeof(Vertex) > size ||
+            record.indexOffset + uint64_t(record.indexCount) * sizeof(unsigned int) > size ||
+            record.textureOffset > size)
+        {
+            return false;
+        }
+
+        uint64_t cursor = record.textureOffset;
+        for (unsigned int j = 0; j < record.textureCount; j++)
+        {
+            uint32_t lengths[2];
+            if (cursor + sizeof(lengths) > size)
+            {
+                return false;
+            }
+            memcpy(lengths, base + cursor, sizeof(lengths));
+            cursor += sizeof(lengths);
+            if (cursor + uint64_t(lengths[0]) + lengths[1] > size)
+            {
+                return false;
+            }
+            string type(reinterpret_cast<const char *>(base + cursor), lengths[0]);
+            string path(reinterpret_cast<const char *>(base + cursor + lengths[0]), lengths[1]);
+            cursor += uint64_t(lengths[0]) + lengths[1];
+            materials[i].push_back(TextureRef{type, path});
+        }
+    }
+
+    meshes.reserve(header->meshCount);
+    for (unsigned int i = 0; i < header->meshCount; i++)
+    {
+        vector<Texture> textures;
+        for (const TextureRef &ref : materials[i])
+        {
+            textures.push_back(loadMaterialTexture(ref.path, ref.type));
+        }
+
+        const ModelCacheMesh &record = records[i];
+        meshes.push_back(Mesh(reinterpret_cast<const Vertex *>(base + record.vertexOffset), record.vertexCount,
+                              reinterpret_cast<const unsigned int *>(base + record.indexOffset), record.indexCount,
+                              textures));
+    }
+    return true;
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene)
+void Model::writeCache(const string &cachePath, uint64_t sourceHash)
 {
-    // process all the node's meshes
+    ModelCacheHeader header{};
+    memcpy(header.magic, MODEL_CACHE_MAGIC, sizeof(MODEL_CACHE_MAGIC));
+    header.version = MODEL_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.importFlags = MODEL_IMPORT_FLAGS;
+    header.vertexStride = sizeof(Vertex);
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+
+    vector<ModelCacheMesh> records(meshes.size());
+    uint64_t offset = sizeof(ModelCacheHeader) + meshes.size() * sizeof(ModelCacheMesh);
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        records[i].vertexOffset = offset;
+        records[i].vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+        offset += meshes[i].vertices.size() * sizeof(Vertex);
+    }
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        records[i].indexOffset = offset;
+        records[i].indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+        offset += meshes[i].indices.size() * sizeof(unsigned int);
+    }
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        records[i].textureOffset = offset;
+        records[i].textureCount = static_cast<uint32_t>(meshes[i].textures.size());
+        for (const Texture &texture : meshes[i].textures)
+        {
+            offset += 2 * sizeof(uint32_t) + texture.type.size() + texture.path.size();
+        }
+    }
+
+    // write to a temporary file first so a concurrent reader never maps a half written cache
+    string tmpPath = cachePath + ".tmp";
+    ofstream out(tmpPath, ios::binary | ios::trunc);
+    if (!out)
+    {
+        cout << "ERROR::MODEL_CACHE::COULD_NOT_OPEN " << tmpPath << endl;
+        return;
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(ModelCacheMesh));
+    for (const Mesh &mesh : meshes)
+    {
+        out.write(reinterpret_cast<const char *>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex));
+    }
+    for (const Mesh &mesh : meshes)
+    {
+        out.write(reinterpret_cast<const char *>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+    }
+    for (const Mesh &mesh : meshes)
+    {
+        for (const Texture &texture : mesh.textures)
+        {
+            uint32_t lengths[2] = {static_cast<uint32_t>(texture.type.size()), static_cast<uint32_t>(texture.path.size())};
+            out.write(reinterpret_cast<const char *>(lengths), sizeof(lengths));
+            out.write(texture.type.data(), texture.type.size());
+            out.write(texture.path.data(), texture.path.size());
+        }
+    }
+    out.close();
+
+    if (!out || std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+    {
+        cout << "ERROR::MODEL_CACHE::WRITE_FAILED " << cachePath << endl;
+        std::remove(tmpPath.c_str());
+    }
+}
+
+void Model::processNode(aiNode *node, const aiScene *scene, vector<aiMesh *> &sceneMeshes)
+{
+    // collect all the node's meshes
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene));
+        sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
     }
 
     // process all the children
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        processNode(node->mChildren[i], scene);
+        processNode(node->mChildren[i], scene, sceneMeshes);
     }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
+// runs on worker threads, must not touch GL or any Model state
+MeshData Model::processMesh(const aiMesh *mesh, const aiScene *scene)
 {
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
-    vector<Texture> textures;
+    MeshData data;
 
+    // value-initialized so unused attributes (tangents, bones) are zero rather than garbage
+    data.vertices.resize(mesh->mNumVertices);
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
-        Vertex vertex;
+        Vertex &vertex = data.vertices[i];
         // process vertex positions, normals, texture coordinates
-        glm::vec3 posVec;
-        posVec.x = mesh->mVertices[i].x;
-        posVec.y = mesh->mVertices[i].y;
-        posVec.z = mesh->mVertices[i].z;
-        vertex.Position = posVec;
-
-        glm::vec3 nomVec;
-        nomVec.x = mesh->mNormals[i].x;
-        nomVec.y = mesh->mNormals[i].y;
-        nomVec.z = mesh->mNormals[i].z;
-        vertex.Normal = nomVec;
+        vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
 
         // up to 8 textures, only care about the first texture
         if (mesh->mTextureCoords[0])
         {
-            glm::vec3 texVec;
-            texVec.x = mesh->mTextureCoords[0][i].x;
-            texVec.y = mesh->mTextureCoords[0][i].y;
-            vertex.TexCoords = texVec;
+            vertex.TexCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
         }
-
-        vertices.push_back(vertex);
     }
 
     // process indices
+    size_t indexCount = 0;
     for (unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
-        aiFace face = mesh->mFaces[i];
-        for (unsigned int j = 0; j < face.mNumIndices; j++)
-        {
-            indices.push_back(face.mIndices[j]);
-        }
+        indexCount += mesh->mFaces[i].mNumIndices;
+    }
+    data.indices.resize(indexCount);
+    unsigned int *index = data.indices.data();
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    {
+        const aiFace &face = mesh->mFaces[i];
+        index = std::copy(face.mIndices, face.mIndices + face.mNumIndices, index);
     }
 
     // process material
     if (mesh->mMaterialIndex >= 0)
     {
-        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        const aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+        collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
+        collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
     }
 
-    return Mesh(vertices, indices, textures);
+    return data;
 }
 
-vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+void Model::collectMaterialTextures(const aiMaterial *mat, aiTextureType type, const string &typeName, vector<TextureRef> &textures)
 {
-    vector<Texture> textures;
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
     {
         aiString str;
         mat->GetTexture(type, i, &str);
-        bool skip = false;
-        for (unsigned int j = 0; j < textures_loaded.size(); j++)
-        {
-            if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-            {
-                textures.push_back(textures_loaded[j]);
-                skip = true;
-                break;
-            }
-        }
-        if (!skip)
-        {
-            Texture texture;
-            texture.id = TextureFromFile(str.C_Str(), directory);
-            texture.type = typeName;
-            texture.path = str.C_Str();
-            textures.push_back(texture);
-            textures_loaded.push_back(texture);
-        }
+        textures.push_back(TextureRef{typeName, str.C_Str()});
     }
-    return textures;
+}
+
+Texture Model::loadMaterialTexture(const string &path, const string &typeName)
+{
+    auto found = textureIndex.find(path);
+    if (found != textureIndex.end())
+    {
+        return textures_loaded[found->second];
+    }
+
+    // the process wide cache shares the GL texture with every other model using the same image
+    TextureHandle handle = textureLoader ? textureLoader->load(directory + '/' + path)
+                                         : TextureCache::instance().load(directory + '/' + path);
+
+    Texture texture;
+    texture.id = handle ? handle->id : 0;
+    texture.type = typeName;
+    texture.path = path;
+    textureIndex.emplace(path, textures_loaded.size());
+    textures_loaded.push_back(texture);
+    textureHandles.push_back(handle);
+    return texture;
 }
 
 void Model::Draw(Shader &shader)
@@ -169,39 +411,7 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        cout << "Texture failed to load at path: " << path << endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return TextureCache::instance().pin(TextureCache::instance().load(filename));
 }
 
 #endif
\ No newline at end of file
@@ -2,15 +2,64 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <loader/uniform_blocks.hpp>
+#include <utils/hash.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// location of an active uniform, look it up once and keep it to skip the name lookup on hot paths
+struct Uniform
+{
+    GLint location = -1;
+};
+
+// preprocessor macros injected after #version, one list per shader variant
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+// linked programs are stored with glGetProgramBinary and reloaded with glProgramBinary on the next launch
+const char PROGRAM_BINARY_MAGIC[4] = {'L', 'G', 'P', 'B'};
+const uint32_t PROGRAM_BINARY_VERSION = 1;
+const char *const PROGRAM_BINARY_EXTENSION = ".programbin";
+
+struct ProgramBinaryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+    // what compiling and linking from source took, used to report the time a cache hit saved
+    double buildMilliseconds;
+};
+
+struct ProgramBinaryStats
+{
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+    // binaries the driver refused, usually after a driver update
+    unsigned int rejected = 0;
+    double loadMilliseconds = 0.0;
+    double buildMilliseconds = 0.0;
+    double savedMilliseconds = 0.0;
+};
+
 class Shader
 {
 public:
@@ -19,8 +68,16 @@ public:
 
     Shader(const char *vertexPath, const char *fragmentPath, bool link = true);
     Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, bool link = true);
+    Shader(const char *vertexPath, const char *fragmentPath, const ShaderDefines &defines, bool link = true);
+    Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, const ShaderDefines &defines, bool link = true);
     ~Shader();
 
+    // where program binaries are kept, an empty string turns the cache off.
+    // defaults to $LEARNOPENGL_SHADER_CACHE or a directory below the system temp directory
+    static void setBinaryCacheDirectory(const std::string &directory);
+    static const ProgramBinaryStats &binaryCacheStats();
+    static void printBinaryCacheStats();
+
     void use();
     void setBool(const std::string &name, bool value) const;
     void setInt(const std::string &name, int value) const;
@@ -29,75 +86,237 @@ public:
     void setVec2(const std::string &name, const glm::vec2 vec2) const;
     void setVec3(const std::string &name, float v1, float v2, float v3) const;
     void setVec3(const std::string &name, const glm::vec3 vec3) const;
+    void setMat3(const std::string &name, const glm::mat3 &value) const;
     void setMat4(const std::string &name, glm::mat4 value) const;
+
+    Uniform uniform(const std::string &name) const;
+    void setBool(Uniform uniform, bool value) const;
+    void setInt(Uniform uniform, int value) const;
+    void setFloat(Uniform uniform, float value) const;
+    void setVec2(Uniform uniform, float v1, float v2) const;
+    void setVec2(Uniform uniform, const glm::vec2 &vec2) const;
+    void setVec3(Uniform uniform, float v1, float v2, float v3) const;
+    void setVec3(Uniform uniform, const glm::vec3 &vec3) const;
+    void setMat3(Uniform uniform, const glm::mat3 &value) const;
+    void setMat4(Uniform uniform, const glm::mat4 &value) const;
+
+private:
+    typedef std::vector<std::pair<GLenum, std::string>> ShaderSources;
+
+    struct BinaryCacheState
+    {
+        std::string directory;
+        // -1 until queried, drivers that report no binary formats can not use the cache
+        GLint formatCount = -1;
+        ProgramBinaryStats stats;
+    };
+
+    // every active uniform of the linked program, filled once right after linking
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    static BinaryCacheState &binaryCache();
+    static std::string readShaderFile(const char *path);
+    static std::string preprocessShader(const char *path, const ShaderDefines &defines);
+    static void appendShaderFile(const std::filesystem::path &path, const std::string &defineBlock,
+                                 std::string &code, std::vector<std::string> &included);
+    static unsigned int compileShader(GLenum type, const std::string &code);
+    static uint64_t programKey(const ShaderSources &sources);
+    static std::string binaryPath(uint64_t key);
+
+    void build(const ShaderSources &sources, bool link);
+    bool loadBinary(uint64_t key);
+    void saveBinary(uint64_t key, double buildMilliseconds);
+    void reflectUniforms();
+    void bindUniformBlocks();
+    GLint location(const std::string &name) const;
 };
 
 Shader::Shader(const char *vertexPath, const char *fragmentPath, bool link)
+    : Shader(vertexPath, fragmentPath, ShaderDefines(), link)
 {
-    // 1. load shader code
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
+}
 
-    // ensure ifstream objects can throw exceptions
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+Shader::Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, bool link)
+    : Shader(vertexPath, fragmentPath, geometryPath, ShaderDefines(), link)
+{
+}
+
+Shader::Shader(const char *vertexPath, const char *fragmentPath, const ShaderDefines &defines, bool link)
+{
+    build({{GL_VERTEX_SHADER, preprocessShader(vertexPath, defines)},
+           {GL_FRAGMENT_SHADER, preprocessShader(fragmentPath, defines)}},
+          link);
+}
 
+Shader::Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, const ShaderDefines &defines, bool link)
+{
+    build({{GL_VERTEX_SHADER, preprocessShader(vertexPath, defines)},
+           {GL_FRAGMENT_SHADER, preprocessShader(fragmentPath, defines)},
+           {GL_GEOMETRY_SHADER, preprocessShader(geometryPath, defines)}},
+          link);
+}
+
+std::string Shader::readShaderFile(const char *path)
+{
+    std::ifstream shaderFile;
+    // ensure ifstream objects can throw exceptions
+    shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
     try
     {
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-        std::stringstream vShaderStream, fShaderStream;
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-        vShaderFile.close();
-        fShaderFile.close();
-        vertexCode = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
+        shaderFile.open(path);
+        std::stringstream shaderStream;
+        shaderStream << shaderFile.rdbuf();
+        shaderFile.close();
+        return shaderStream.str();
     }
-    catch (std::ifstream::failure e)
+    catch (const std::ifstream::failure &e)
     {
-        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
     }
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
+    return std::string();
+}
 
-    // 2. compile shaders
-    unsigned int vertex, fragment;
-    int success;
-    char infoLog[512];
+// resolves #include "file" relative to the including file and places the defines right after #version.
+// every file is pasted at most once per stage, so shared files need no include guards of their own
+std::string Shader::preprocessShader(const char *path, const ShaderDefines &defines)
+{
+    // sorted so the same set of defines always produces the same source and binary cache key
+    ShaderDefines sortedDefines(defines);
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    std::string defineBlock;
+    for (const auto &define : sortedDefines)
+    {
+        defineBlock += "#define " + define.first + " " + define.second + "\n";
+    }
 
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
+    std::string code;
+    std::vector<std::string> included;
+    appendShaderFile(path, defineBlock, code, included);
+    return code;
+}
+
+void Shader::appendShaderFile(const std::filesystem::path &path, const std::string &defineBlock,
+                              std::string &code, std::vector<std::string> &included)
+{
+    std::error_code error;
+    std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(path, error);
+    const std::string key = error ? path.string() : canonicalPath.string();
+    if (std::find(included.begin(), included.end(), key) != included.end())
     {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-        success = 1;
+        return;
+    }
+    // files are numbered in include order, compile errors then read "<file number>(<line>)"
+    const int sourceNumber = static_cast<int>(included.size());
+    included.push_back(key);
+
+    const std::string source = readShaderFile(path.string().c_str());
+    bool definesPlaced = sourceNumber > 0 || defineBlock.empty();
+    if (sourceNumber > 0)
+    {
+        code += "#line 1 " + std::to_string(sourceNumber) + "\n";
+    }
+
+    std::istringstream lines(source);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(lines, line))
+    {
+        lineNumber++;
+        const size_t start = line.find_first_not_of(" \t");
+        const bool directive = start != std::string::npos && line[start] == '#';
+        if (directive && line.compare(start, 8, "#include") == 0)
+        {
+            const size_t open = line.find('"', start + 8);
+            const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+            if (close == std::string::npos)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_MALFORMED " << path.string() << ":" << lineNumber << std::endl;
+                code += "\n";
+                continue;
+            }
+            appendShaderFile(path.parent_path() / line.substr(open + 1, close - open - 1), defineBlock, code, included);
+            code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+            continue;
+        }
+        if (directive && line.compare(start, 12, "#pragma once") == 0)
+        {
+            code += "\n";
+            continue;
+        }
+
+        code += line + "\n";
+        if (!definesPlaced && directive && line.compare(start, 8, "#version") == 0)
+        {
+            code += defineBlock + "#line " + std::to_string(lineNumber + 1) + " 0\n";
+            definesPlaced = true;
+        }
     }
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+    // no #version line, the defines simply go first
+    if (!definesPlaced)
+    {
+        code.insert(0, defineBlock + "#line 1 0\n");
+    }
+}
+
+unsigned int Shader::compileShader(GLenum type, const std::string &code)
+{
+    const char *shaderCode = code.c_str();
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &shaderCode, NULL);
+    glCompileShader(shader);
+
+    int success;
+    char infoLog[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+        const char *stage = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT"
+                                                                                            : "GEOMETRY";
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED\n"
                   << infoLog << std::endl;
-        success = 1;
     }
+    return shader;
+}
 
+void Shader::build(const ShaderSources &sources, bool link)
+{
     ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
+
+    // an unlinked program is only a container for more stages, there is nothing to cache yet
+    BinaryCacheState &cache = binaryCache();
+    if (link && !cache.directory.empty() && cache.formatCount < 0)
+    {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &cache.formatCount);
+    }
+    const bool cached = link && !cache.directory.empty() && cache.formatCount > 0;
+    const uint64_t key = cached ? programKey(sources) : 0;
+    if (cached && loadBinary(key))
+    {
+        reflectUniforms();
+        bindUniformBlocks();
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<unsigned int> shaders;
+    for (const auto &source : sources)
+    {
+        shaders.push_back(compileShader(source.first, source.second));
+        glAttachShader(ID, shaders.back());
+    }
+
     if (link)
     {
+        if (cached)
+        {
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glLinkProgram(ID);
+
+        int success;
+        char infoLog[512];
         glGetProgramiv(ID, GL_LINK_STATUS, &success);
         if (!success)
         {
@@ -105,66 +324,180 @@ Shader::Shader(const char *vertexPath, const char *fragmentPath, bool link)
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
                       << infoLog << std::endl;
         }
+        else if (cached)
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            cache.stats.misses++;
+            cache.stats.buildMilliseconds += elapsed.count();
+            saveBinary(key, elapsed.count());
+        }
+        reflectUniforms();
+        bindUniformBlocks();
     }
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    for (unsigned int shader : shaders)
+    {
+        glDeleteShader(shader);
+    }
 }
 
-Shader::Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, bool link) : Shader(vertexPath, fragmentPath, false)
+Shader::BinaryCacheState &Shader::binaryCache()
 {
-    // 1. load shader code
-    std::string geometryCode;
-    std::ifstream gShaderFile;
+    static BinaryCacheState state = []()
+    {
+        BinaryCacheState initial;
+        if (const char *directory = std::getenv("LEARNOPENGL_SHADER_CACHE"))
+        {
+            initial.directory = directory;
+        }
+        else
+        {
+            std::error_code error;
+            std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+            if (!error)
+            {
+                initial.directory = (temp / "learnopengl-shader-cache").string();
+            }
+        }
+        return initial;
+    }();
+    return state;
+}
 
-    // ensure ifstream objects can throw exceptions
-    gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+void Shader::setBinaryCacheDirectory(const std::string &directory)
+{
+    binaryCache().directory = directory;
+}
 
-    try
+const ProgramBinaryStats &Shader::binaryCacheStats()
+{
+    return binaryCache().stats;
+}
+
+void Shader::printBinaryCacheStats()
+{
+    const ProgramBinaryStats &stats = binaryCache().stats;
+    std::cout << "shader binary cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.rejected << " rejected, " << stats.loadMilliseconds << "ms loading, "
+              << stats.buildMilliseconds << "ms compiling, " << stats.savedMilliseconds << "ms saved" << std::endl;
+}
+
+// the sources together with the driver strings, a driver update or any source edit changes the key
+uint64_t Shader::programKey(const ShaderSources &sources)
+{
+    uint64_t key = fnv1aHash(&PROGRAM_BINARY_VERSION, sizeof(PROGRAM_BINARY_VERSION));
+    for (const auto &source : sources)
     {
-        gShaderFile.open(geometryPath);
-        std::stringstream gShaderStream;
-        gShaderStream << gShaderFile.rdbuf();
-        gShaderFile.close();
-        geometryCode = gShaderStream.str();
+        const uint32_t type = source.first;
+        key = fnv1aHash(&type, sizeof(type), key);
+        const uint64_t length = source.second.size();
+        key = fnv1aHash(&length, sizeof(length), key);
+        key = fnv1aHash(source.second.data(), source.second.size(), key);
     }
-    catch (std::ifstream::failure e)
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
     {
-        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        const char *value = reinterpret_cast<const char *>(glGetString(name));
+        if (value)
+        {
+            key = fnv1aHash(value, strlen(value) + 1, key);
+        }
     }
-    const char *gShaderCode = geometryCode.c_str();
+    return key;
+}
 
-    // 2. compile shaders
-    unsigned int geometry;
-    int success;
-    char infoLog[512];
+std::string Shader::binaryPath(uint64_t key)
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(binaryCache().directory) / (std::string(name) + PROGRAM_BINARY_EXTENSION)).string();
+}
+
+bool Shader::loadBinary(uint64_t key)
+{
+    BinaryCacheState &cache = binaryCache();
+    const auto start = std::chrono::steady_clock::now();
+    const std::string path = binaryPath(key);
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
 
-    geometry = glCreateShader(GL_GEOMETRY_SHADER);
-    glShaderSource(geometry, 1, &gShaderCode, NULL);
-    glCompileShader(geometry);
-    glGetShaderiv(geometry, GL_COMPILE_STATUS, &success);
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (in && memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == PROGRAM_BINARY_VERSION && header.key == key)
+    {
+        binary.resize(header.binaryLength);
+        in.read(binary.data(), binary.size());
+    }
+    if (binary.empty() || !in)
+    {
+        in.close();
+        std::remove(path.c_str());
+        return false;
+    }
+
+    glProgramBinary(ID, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    int success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(geometry, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-        success = 1;
+        // the driver no longer accepts it, drop the file and compile from source instead
+        in.close();
+        std::remove(path.c_str());
+        cache.stats.rejected++;
+        return false;
     }
 
-    glAttachShader(ID, geometry);
-    if (link)
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    cache.stats.hits++;
+    cache.stats.loadMilliseconds += elapsed.count();
+    cache.stats.savedMilliseconds += header.buildMilliseconds - elapsed.count();
+    return true;
+}
+
+void Shader::saveBinary(uint64_t key, double buildMilliseconds)
+{
+    GLint length = 0;
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
     {
-        glLinkProgram(ID);
-        glGetProgramiv(ID, GL_LINK_STATUS, &success);
-        if (!success)
-        {
-            glGetProgramInfoLog(ID, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                      << infoLog << std::endl;
-        }
+        return;
     }
+    std::vector<char> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(ID, length, &length, &binaryFormat, binary.data());
 
-    glDeleteShader(geometry);
+    std::error_code error;
+    std::filesystem::create_directories(binaryCache().directory, error);
+
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_BINARY_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binaryLength = static_cast<uint32_t>(length);
+    header.buildMilliseconds = buildMilliseconds;
+
+    // write to a temporary file first so a crash never leaves a truncated binary behind
+    const std::string path = binaryPath(key);
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "ERROR::SHADER::BINARY_CACHE::COULD_NOT_OPEN " << tmpPath << std::endl;
+        return;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(binary.data(), length);
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "ERROR::SHADER::BINARY_CACHE::WRITE_FAILED " << path << std::endl;
+        std::remove(tmpPath.c_str());
+    }
 }
 
 Shader::~Shader()
@@ -177,37 +510,190 @@ void Shader::use()
     glUseProgram(ID);
 }
 
+void Shader::reflectUniforms()
+{
+    uniformLocations.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::string name(maxLength > 0 ? maxLength : 1, '\0');
+    for (GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(ID, i, static_cast<GLsizei>(name.size()), &length, &size, &type, &name[0]);
+        std::string uniformName = name.substr(0, length);
+        GLint uniformLocation = glGetUniformLocation(ID, uniformName.c_str());
+        if (uniformLocation < 0)
+        {
+            // uniforms inside blocks have no location
+            continue;
+        }
+        uniformLocations[uniformName] = uniformLocation;
+
+        // arrays of basic types are reported once as "name[0]", register "name" and every element too
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+        {
+            std::string base = uniformName.substr(0, uniformName.size() - 3);
+            uniformLocations[base] = uniformLocation;
+            for (GLint element = 1; element < size; element++)
+            {
+                std::string elementName = base + '[' + std::to_string(element) + ']';
+                uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+            }
+        }
+    }
+}
+
+void Shader::bindUniformBlocks()
+{
+    for (const UniformBlockSlot &slot : UNIFORM_BLOCK_SLOTS)
+    {
+        GLuint index = glGetUniformBlockIndex(ID, slot.name);
+        if (index != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(ID, index, slot.binding);
+        }
+    }
+}
+
+GLint Shader::location(const std::string &name) const
+{
+    auto it = uniformLocations.find(name);
+    return it == uniformLocations.end() ? -1 : it->second;
+}
+
+Uniform Shader::uniform(const std::string &name) const
+{
+    return Uniform{location(name)};
+}
+
 void Shader::setBool(const std::string &name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(location(name), (int)value);
 }
 void Shader::setInt(const std::string &name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location(name), value);
 }
 void Shader::setFloat(const std::string &name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(location(name), value);
 }
 void Shader::setVec2(const std::string &name, float v0, float v1) const
 {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), v0, v1);
+    glUniform2f(location(name), v0, v1);
 }
 void Shader::setVec2(const std::string &name, const glm::vec2 vec2) const
 {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), vec2[0], vec2[1]);
+    glUniform2f(location(name), vec2[0], vec2[1]);
 }
 void Shader::setVec3(const std::string &name, float v0, float v1, float v2) const
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), v0, v1, v2);
+    glUniform3f(location(name), v0, v1, v2);
 }
 void Shader::setVec3(const std::string &name, const glm::vec3 vec3) const
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), vec3[0], vec3[1], vec3[2]);
+    glUniform3f(location(name), vec3[0], vec3[1], vec3[2]);
+}
+void Shader::setMat3(const std::string &name, const glm::mat3 &value) const
+{
+    glUniformMatrix3fv(location(name), 1, GL_FALSE, glm::value_ptr(value));
 }
 void Shader::setMat4(const std::string &name, glm::mat4 value) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setBool(Uniform uniform, bool value) const
+{
+    glUniform1i(uniform.location, (int)value);
+}
+void Shader::setInt(Uniform uniform, int value) const
+{
+    glUniform1i(uniform.location, value);
+}
+void Shader::setFloat(Uniform uniform, float value) const
+{
+    glUniform1f(uniform.location, value);
+}
+void Shader::setVec2(Uniform uniform, float v0, float v1) const
+{
+    glUniform2f(uniform.location, v0, v1);
+}
+void Shader::setVec2(Uniform uniform, const glm::vec2 &vec2) const
+{
+    glUniform2f(uniform.location, vec2[0], vec2[1]);
+}
+void Shader::setVec3(Uniform uniform, float v0, float v1, float v2) const
+{
+    glUniform3f(uniform.location, v0, v1, v2);
+}
+void Shader::setVec3(Uniform uniform, const glm::vec3 &vec3) const
+{
+    glUniform3f(uniform.location, vec3[0], vec3[1], vec3[2]);
+}
+void Shader::setMat3(Uniform uniform, const glm::mat3 &value) const
+{
+    glUniformMatrix3fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+void Shader::setMat4(Uniform uniform, const glm::mat4 &value) const
+{
+    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+// compiles every combination of defines on first use and keeps it, so specialised programs can be
+// picked per draw call without any branching on uniforms inside the shaders
+class ShaderVariants
+{
+public:
+    ShaderVariants(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = "");
+
+    Shader &get(const ShaderDefines &defines = ShaderDefines());
+    size_t size() const;
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;
+    std::unordered_map<std::string, std::unique_ptr<Shader>> variants;
+};
+
+ShaderVariants::ShaderVariants(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath)
+{
+}
+
+Shader &ShaderVariants::get(const ShaderDefines &defines)
+{
+    ShaderDefines sortedDefines(defines);
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    std::string key;
+    for (const auto &define : sortedDefines)
+    {
+        key += define.first + '=' + define.second + ';';
+    }
+
+    std::unique_ptr<Shader> &variant = variants[key];
+    if (!variant)
+    {
+        if (geometryPath.empty())
+        {
+            variant.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), sortedDefines));
+        }
+        else
+        {
+            variant.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometryPath.c_str(), sortedDefines));
+        }
+    }
+    return *variant;
+}
+
+size_t ShaderVariants::size() const
+{
+    return variants.size();
 }
 
 #endif
\ No newline at end of file
@@ -1,12 +1,8 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#ifndef STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_IMPLEMENTATION
-#include <loader/stb_image.h>
-#endif
-
 #include <glad/glad.h>
+#include <loader/texture_cache.hpp>
 #include <iostream>
 #include <stdexcept>
 
@@ -19,46 +15,23 @@ struct TextureInfo {
 
 TextureInfo loadTexture(char const *path, GLenum wrapS = GL_REPEAT, GLenum wrapT = GL_REPEAT)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    TextureOptions options;
+    options.wrapS = wrapS;
+    options.wrapT = wrapT;
+    options.flipVertically = true;
 
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true); 
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+    TextureHandle texture = TextureCache::instance().load(path, options);
+    if (!texture)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-
-        return TextureInfo{
-            textureID,
-            width,
-            height,
-            format
-        };
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
         throw std::runtime_error("Could not load texture.");
     }
+
+    return TextureInfo{
+        TextureCache::instance().pin(texture),
+        texture->width,
+        texture->height,
+        texture->format
+    };
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,435 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#ifndef STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#include <loader/stb_image.h>
+#endif
+
+#include <glad/glad.h>
+#include <loader/ktx2.hpp>
+#include <utils/hash.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CachedTexture
+{
+    unsigned int id;
+    GLenum target;
+    int width;
+    int height;
+    GLenum format;
+};
+
+// shared ownership of a GL texture, the texture is released once the last handle is dropped
+using TextureHandle = std::shared_ptr<const CachedTexture>;
+
+struct TextureOptions
+{
+    GLenum wrapS = GL_REPEAT;
+    GLenum wrapT = GL_REPEAT;
+    bool flipVertically = false;
+};
+
+GLenum textureFormat(int nrComponents)
+{
+    if (nrComponents == 1)
+        return GL_RED;
+    else if (nrComponents == 2)
+        return GL_RG;
+    else if (nrComponents == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+// decode an encoded image held in memory, the flip flag is per thread so this is safe on workers
+unsigned char *decodeImage(const std::vector<unsigned char> &bytes, bool flipVertically, int &width, int &height, int &nrComponents)
+{
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+    return stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &width, &height, &nrComponents, 0);
+}
+
+// (re)specify a 2D texture from 8-bit pixels, generate its mip chain and apply the sampler options
+void uploadTexture2D(unsigned int id, GLenum format, int width, int height, const unsigned char *pixels, const TextureOptions &options)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrapT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// process wide texture cache. textures are looked up by canonical path first, and by a hash of the
+// file content on a miss, so the same image reached through different paths is decoded and uploaded once.
+class TextureCache
+{
+public:
+    static TextureCache &instance();
+
+    TextureHandle load(const std::string &path, const TextureOptions &options = TextureOptions());
+    TextureHandle loadCubemap(const std::vector<std::string> &faces);
+    // the cached texture for path, or a new one holding a 1x1 placeholder texel, in which case created is set
+    TextureHandle reserve(const std::string &path, const TextureOptions &options, bool &created);
+    // replace the placeholder of a reserved texture with its decoded image
+    void fulfil(const TextureHandle &handle, const TextureOptions &options, uint64_t contentHash,
+                const unsigned char *pixels, int width, int height, int nrComponents);
+    void fulfil(const TextureHandle &handle, const TextureOptions &options, uint64_t contentHash, const Ktx2Image &image);
+    // keep a texture alive until exit, for the loaders that hand out raw texture ids
+    unsigned int pin(const TextureHandle &handle);
+    // delete the GL textures whose last handle was dropped, must be called on the context thread
+    void purge();
+    size_t size();
+
+    static bool readFile(const std::string &path, std::vector<unsigned char> &bytes);
+    // read the precompressed .ktx2 sibling of path if there is one the driver can sample
+    static bool readCompressedSibling(const std::string &path, const TextureOptions &options,
+                                      const CompressedFormatSupport &support, Ktx2Image &image, uint64_t &contentHash);
+    static std::string hashKey(uint64_t hash);
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<const CachedTexture>> byPath;
+    std::unordered_map<std::string, std::weak_ptr<const CachedTexture>> byContent;
+    std::unordered_map<unsigned int, TextureHandle> pinned;
+
+    // handles can be dropped on any thread, so deletion is deferred to purge()
+    std::mutex releasedMutex;
+    std::vector<unsigned int> released;
+
+    TextureCache() = default;
+    TextureHandle track(const CachedTexture &texture);
+    void remember(const std::string &pathKey, const std::string &contentKey, const TextureHandle &handle);
+    TextureHandle find(const std::unordered_map<std::string, std::weak_ptr<const CachedTexture>> &index, const std::string &key) const;
+    static std::string canonicalPath(const std::string &path);
+    static std::string optionsKey(const TextureOptions &options);
+};
+
+TextureCache &TextureCache::instance()
+{
+    // never destroyed, GL objects must not be touched from static destructors after the context is gone
+    static TextureCache *cache = new TextureCache();
+    return *cache;
+}
+
+TextureHandle TextureCache::load(const std::string &path, const TextureOptions &options)
+{
+    purge();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const std::string variant = optionsKey(options);
+    const std::string pathKey = canonicalPath(path) + '|' + variant;
+    if (TextureHandle cached = find(byPath, pathKey))
+    {
+        return cached;
+    }
+
+    // a precompressed sibling is uploaded as is, with its stored mip chain
+    Ktx2Image compressed;
+    uint64_t compressedHash = 0;
+    if (readCompressedSibling(path, options, compressedFormatSupport(), compressed, compressedHash))
+    {
+        const std::string contentKey = "ktx2|" + hashKey(compressedHash) + '|' + variant;
+        if (TextureHandle cached = find(byContent, contentKey))
+        {
+            byPath[pathKey] = cached;
+            return cached;
+        }
+
+        CachedTexture texture{0, GL_TEXTURE_2D, compressed.width, compressed.height, ktx2BaseFormat(compressed.vkFormat)};
+        glGenTextures(1, &texture.id);
+        uploadCompressedTexture2D(texture.id, compressed, options.wrapS, options.wrapT);
+
+        TextureHandle handle = track(texture);
+        remember(pathKey, contentKey, handle);
+        return handle;
+    }
+
+    std::vector<unsigned char> bytes;
+    if (!readFile(path, bytes))
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return nullptr;
+    }
+
+    const std::string contentKey = hashKey(fnv1aHash(bytes.data(), bytes.size())) + '|' + variant;
+    if (TextureHandle cached = find(byContent, contentKey))
+    {
+        byPath[pathKey] = cached;
+        return cached;
+    }
+
+    int width, height, nrComponents;
+    unsigned char *data = decodeImage(bytes, options.flipVertically, width, height, nrComponents);
+    if (!data)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return nullptr;
+    }
+
+    CachedTexture texture{0, GL_TEXTURE_2D, width, height, textureFormat(nrComponents)};
+    glGenTextures(1, &texture.id);
+    uploadTexture2D(texture.id, texture.format, width, height, data, options);
+
+    stbi_image_free(data);
+
+    TextureHandle handle = track(texture);
+    remember(pathKey, contentKey, handle);
+    return handle;
+}
+
+TextureHandle TextureCache::loadCubemap(const std::vector<std::string> &faces)
+{
+    purge();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string pathKey = "cube";
+    for (const std::string &face : faces)
+    {
+        pathKey += '|' + canonicalPath(face);
+    }
+    if (TextureHandle cached = find(byPath, pathKey))
+    {
+        return cached;
+    }
+
+    std::vector<std::vector<unsigned char>> faceBytes(faces.size());
+    uint64_t hash = FNV1A_OFFSET_BASIS;
+    for (unsigned int i = 0; i < faces.size(); i++)
+    {
+        // a missing face is uploaded as nothing, like before, but still changes the content key
+        if (!readFile(faces[i], faceBytes[i]))
+        {
+            faceBytes[i].clear();
+        }
+        uint64_t faceHash = fnv1aHash(faceBytes[i].data(), faceBytes[i].size());
+        hash = fnv1aHash(&faceHash, sizeof(faceHash), hash);
+    }
+    const std::string contentKey = "cube|" + hashKey(hash);
+    if (TextureHandle cached = find(byContent, contentKey))
+    {
+        byPath[pathKey] = cached;
+        return cached;
+    }
+
+    CachedTexture texture{0, GL_TEXTURE_CUBE_MAP, 0, 0, GL_RGB};
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture.id);
+
+    int width, height, nrChannels;
+    for (unsigned int i = 0; i < faces.size(); i++)
+    {
+        unsigned char *data = decodeImage(faceBytes[i], false, width, height, nrChannels);
+        if (data)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+            texture.width = width;
+            texture.height = height;
+            stbi_image_free(data);
+        }
+        else
+        {
+            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+        }
+    }
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    TextureHandle handle = track(texture);
+    remember(pathKey, contentKey, handle);
+    return handle;
+}
+
+TextureHandle TextureCache::reserve(const std::string &path, const TextureOptions &options, bool &created)
+{
+    purge();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const std::string pathKey = canonicalPath(path) + '|' + optionsKey(options);
+    created = false;
+    if (TextureHandle cached = find(byPath, pathKey))
+    {
+        return cached;
+    }
+
+    static const unsigned char placeholder[4] = {128, 128, 128, 255};
+    CachedTexture texture{0, GL_TEXTURE_2D, 1, 1, GL_RGBA};
+    glGenTextures(1, &texture.id);
+    uploadTexture2D(texture.id, texture.format, 1, 1, placeholder, options);
+
+    // only the path is known yet, the content key is registered by fulfil()
+    TextureHandle handle = track(texture);
+    byPath[pathKey] = handle;
+    created = true;
+    return handle;
+}
+
+void TextureCache::fulfil(const TextureHandle &handle, const TextureOptions &options, uint64_t contentHash,
+                          const unsigned char *pixels, int width, int height, int nrComponents)
+{
+    // the cache allocated every CachedTexture itself, so dropping const here is well defined
+    CachedTexture *texture = const_cast<CachedTexture *>(handle.get());
+    texture->width = width;
+    texture->height = height;
+    texture->format = textureFormat(nrComponents);
+    uploadTexture2D(texture->id, texture->format, width, height, pixels, options);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::string contentKey = hashKey(contentHash) + '|' + optionsKey(options);
+    if (!find(byContent, contentKey))
+    {
+        byContent[contentKey] = handle;
+    }
+}
+
+void TextureCache::fulfil(const TextureHandle &handle, const TextureOptions &options, uint64_t contentHash, const Ktx2Image &image)
+{
+    CachedTexture *texture = const_cast<CachedTexture *>(handle.get());
+    texture->width = image.width;
+    texture->height = image.height;
+    texture->format = ktx2BaseFormat(image.vkFormat);
+    uploadCompressedTexture2D(texture->id, image, options.wrapS, options.wrapT);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::string contentKey = "ktx2|" + hashKey(contentHash) + '|' + optionsKey(options);
+    if (!find(byContent, contentKey))
+    {
+        byContent[contentKey] = handle;
+    }
+}
+
+unsigned int TextureCache::pin(const TextureHandle &handle)
+{
+    if (!handle)
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    pinned.emplace(handle->id, handle);
+    return handle->id;
+}
+
+void TextureCache::purge()
+{
+    std::vector<unsigned int> ids;
+    {
+        std::lock_guard<std::mutex> lock(releasedMutex);
+        ids.swap(released);
+    }
+    if (ids.empty())
+    {
+        return;
+    }
+    glDeleteTextures(static_cast<GLsizei>(ids.size()), ids.data());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = byPath.begin(); it != byPath.end();)
+    {
+        it = it->second.expired() ? byPath.erase(it) : std::next(it);
+    }
+    for (auto it = byContent.begin(); it != byContent.end();)
+    {
+        it = it->second.expired() ? byContent.erase(it) : std::next(it);
+    }
+}
+
+size_t TextureCache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t alive = 0;
+    for (const auto &entry : byContent)
+    {
+        alive += entry.second.expired() ? 0 : 1;
+    }
+    return alive;
+}
+
+TextureHandle TextureCache::track(const CachedTexture &texture)
+{
+    return TextureHandle(new CachedTexture(texture), [this](const CachedTexture *dropped)
+                         {
+                             {
+                                 std::lock_guard<std::mutex> lock(releasedMutex);
+                                 released.push_back(dropped->id);
+                             }
+                             delete dropped; });
+}
+
+void TextureCache::remember(const std::string &pathKey, const std::string &contentKey, const TextureHandle &handle)
+{
+    byPath[pathKey] = handle;
+    byContent[contentKey] = handle;
+}
+
+TextureHandle TextureCache::find(const std::unordered_map<std::string, std::weak_ptr<const CachedTexture>> &index, const std::string &key) const
+{
+    auto it = index.find(key);
+    return it == index.end() ? nullptr : it->second.lock();
+}
+
+bool TextureCache::readCompressedSibling(const std::string &path, const TextureOptions &options,
+                                         const CompressedFormatSupport &support, Ktx2Image &image, uint64_t &contentHash)
+{
+    // block compressed data can not be flipped on load, flipped textures always take the stb path
+    if (options.flipVertically)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> bytes;
+    if (!readFile(ktx2SiblingPath(path), bytes))
+    {
+        return false;
+    }
+    contentHash = fnv1aHash(bytes.data(), bytes.size());
+    return readKtx2(std::move(bytes), image) && ktx2FormatSupported(image.vkFormat, support);
+}
+
+std::string TextureCache::canonicalPath(const std::string &path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.string();
+}
+
+std::string TextureCache::optionsKey(const TextureOptions &options)
+{
+    return std::to_string(options.wrapS) + ',' + std::to_string(options.wrapT) + ',' + (options.flipVertically ? '1' : '0');
+}
+
+std::string TextureCache::hashKey(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string key(16, '0');
+    for (int i = 15; i >= 0; i--, hash >>= 4)
+    {
+        key[i] = digits[hash & 0xf];
+    }
+    return key;
+}
+
+bool TextureCache::readFile(const std::string &path, std::vector<unsigned char> &bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !bytes.empty();
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// per-frame data shared by every program through std140 uniform blocks. the structs below mirror
+// the GLSL blocks byte for byte: every vec3 is followed by a float so it fills a whole 16 byte slot.
+//
+//   layout (std140) uniform Camera
+//   {
+//       mat4 projection;
+//       mat4 view;
+//       vec3 viewPos;
+//   };
+//
+// the Lights block and its structs live in lighting/multipleLights/shaders/lights.glsl
+enum EUniformBlockBinding
+{
+    EUniformBlockBinding_CAMERA = 0,
+    EUniformBlockBinding_LIGHTS = 1,
+};
+
+struct UniformBlockSlot
+{
+    const char *name;
+    GLuint binding;
+};
+
+// Shader binds every block it finds under one of these names right after linking
+const UniformBlockSlot UNIFORM_BLOCK_SLOTS[] = {
+    {"Camera", EUniformBlockBinding_CAMERA},
+    {"Lights", EUniformBlockBinding_LIGHTS},
+};
+
+const unsigned int MAX_POINT_LIGHTS = 4;
+
+struct CameraBlock
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    float padding;
+};
+
+struct DirLightData
+{
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct PointLightData
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float padding;
+};
+
+struct SpotLightData
+{
+    glm::vec3 position;
+    float cutOff;
+    glm::vec3 direction;
+    float outerCutOff;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+};
+
+struct LightsBlock
+{
+    DirLightData dirLight;
+    SpotLightData spotLight;
+    PointLightData pointLights[MAX_POINT_LIGHTS];
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 Camera block");
+static_assert(sizeof(LightsBlock) == 64 + 80 + 64 * MAX_POINT_LIGHTS, "LightsBlock must match the std140 Lights block");
+
+// one buffer per block, bound once to its binding point and rewritten with a single glBufferSubData
+template <typename T>
+class UniformBuffer
+{
+public:
+    T data;
+
+    explicit UniformBuffer(GLuint binding);
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer &) = delete;
+    UniformBuffer &operator=(const UniformBuffer &) = delete;
+
+    // send the whole of data to the GPU, call once per frame after filling it in
+    void upload();
+
+private:
+    unsigned int buffer;
+};
+
+template <typename T>
+UniformBuffer<T>::UniformBuffer(GLuint binding) : data()
+{
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+template <typename T>
+UniformBuffer<T>::~UniformBuffer()
+{
+    glDeleteBuffers(1, &buffer);
+}
+
+template <typename T>
+void UniformBuffer<T>::upload()
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+#endif
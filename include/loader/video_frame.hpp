@@ -15,31 +15,261 @@ extern "C"
 }
 
 #include <GLFW/glfw3.h>
+#include <loader/shader.h>
+#include <utils/hash.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
+// the loader is generated for core 4.1 without extensions, buffer storage (4.4 or ARB_buffer_storage) is declared here
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+typedef void (APIENTRYP PFNVIDEOBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+// frame index written next to the video, bump the version whenever the layout changes
+const char VIDEO_INDEX_MAGIC[4] = {'L', 'G', 'V', 'I'};
+const uint32_t VIDEO_INDEX_VERSION = 1;
+const char *const VIDEO_INDEX_EXTENSION = ".frameindex";
+
+// file layout: header, the pts of every frame, the pts of the keyframes, both sorted
+struct VideoIndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceKey;
+    uint32_t streamIndex;
+    uint32_t frameCount;
+    uint32_t keyframeCount;
+    uint32_t reserved;
+};
+
+struct VideoDecodeStats
+{
+    // frames decoded ahead and waiting for extractFrame, out of queueDepth
+    size_t readyFrames;
+    size_t queueDepth;
+    uint64_t decodedFrames;
+    // extractFrame calls that found the queue empty and had to wait for the decoder
+    uint64_t underruns;
+    // demux and decode time per frame on the decode thread
+    double meanDecodeMilliseconds;
+    double maxDecodeMilliseconds;
+    // frames displayPlanes uploaded straight from the buffer the decoder wrote them into
+    uint64_t zeroCopyFrames;
+    // frames of the loop resident in the loop cache, the decoder stops once all of them are
+    size_t cachedFrames;
+};
+
+// demuxes and decodes on a background thread into a bounded queue of ready frames, extractFrame only takes
+// the next one. the decoder runs up to queueDepth frames ahead and uses FFmpeg's frame and slice threading,
+// so a slow GOP is absorbed by the queue instead of stalling the render loop. frames come from a fixed pool
+// and the one packet is reused, nothing is allocated per frame.
 class VideoFrameLoader
 {
 public:
-    VideoFrameLoader(const char *videoFileName);
+    // with getProcAddress, e.g. glfwGetProcAddress, the decoder writes 8 bit YUV frames straight into a persistently
+    // mapped unpack buffer and displayPlanes uploads from there without touching the pixels on the CPU. it needs
+    // GL 4.4 or ARB_buffer_storage, without them or when all buffers are busy frames take the copying path
+    // the pts of every frame and which are keyframes are read from the whole file once and, with indexCache, kept
+    // in a .frameindex file next to it for the next time
+    VideoFrameLoader(const char *videoFileName, unsigned int queueDepth = 4, GLADloadproc getProcAddress = nullptr,
+                     bool indexCache = true);
     ~VideoFrameLoader();
+    // false once the video ended, with loop the decoder starts over instead
     bool extractFrame(bool loop = false);
+    // frames in the index, frame n is the n-th video packet in presentation order
+    size_t frameCount() const;
+    // makes frame `index` the current frame like extractFrame does, decoding from the closest keyframe before it.
+    // waits for the decoder unless the frame is still queued or in the scrub cache, false past the end
+    bool seekToFrame(size_t index);
+    // seekToFrame for the frame on screen `seconds` after the start
+    bool seekToTime(double seconds);
+    // keeps the last `frames` current frames so scrubbing back over them needs no decoding. they keep their decoder
+    // buffers, with zero copy decode more frames take the copying path. 0 (the default) turns it off
+    void setScrubCache(size_t frames);
+    // uploads the current frame into textureID bound to texture unit i. the texture is specified once and then
+    // only updated through a ring of pixel unpack buffers, the RGB conversion writes straight into their memory
     void displayFrame(GLuint textureID, unsigned int i);
+    // without mipmaps the video is sampled linearly and the mip chain is not rebuilt after every frame,
+    // fine unless the video is shown much smaller than its size. on by default
+    void setMipmaps(bool enabled);
+    // uploads the current frame's planes untouched, Y, U and V as single channel array textures or Y and the
+    // interleaved UV of NV12 as a single and a two channel one, on units firstUnit and up. the shader converts to RGB with
+    // sampleVideo() from video.glsl, which needs half the upload of RGB for 4:2:0 and no CPU conversion. other
+    // formats, e.g. 10 bit ones, are converted to 8 bit YUV420P first
+    void displayPlanes(unsigned int firstUnit);
+    // keeps every frame of a clip whose planes fit in budgetBytes as a layer of the plane textures. once a whole
+    // pass of the loop is resident the decoder stops and displayPlanes only selects the layer, displayFrame is not
+    // served from the cache. call before the first displayPlanes, 0 (the default) turns it off
+    void setLoopCache(size_t budgetBytes);
+    // sets the VideoPlanes uniform `name` of video.glsl for the planes of the last displayPlanes call
+    void setPlaneUniforms(const Shader &shader, const std::string &name) const;
+    VideoDecodeStats stats() const;
 
 private:
     char *filename;
     AVFormatContext *formatContext;
     AVCodecContext *codecContext;
+    // the frame handed out by the last extractFrame, owned by the render thread until the next one
     AVFrame *frame;
     SwsContext *sws_ctx;
     int videoStreamIndex;
 
+    // decode thread, frames move from freeFrames to readyFrames and back through extractFrame
+    std::vector<AVFrame *> framePool;
+    std::vector<AVFrame *> freeFrames;
+    // frames with their position in the clip, counted from the last start over
+    struct QueuedFrame
+    {
+        AVFrame *frame;
+        size_t index;
+    };
+    std::deque<QueuedFrame> readyFrames;
+    AVPacket *packet;
+    bool ended;
+    bool looping;
+    bool stopping;
+    mutable std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable frameReleased;
+    std::thread decoder;
+    // the first error seen by the decode thread, rethrown on the render thread
+    std::exception_ptr decoderError;
+    // frames per pass of the loop, known once the decoder first reached the end
+    size_t clipFrames;
+    // the current frame's position in the clip
+    size_t frameIndex;
+    // a seek for the decode thread, frames decoded for an older generation are dropped
+    bool seekPending;
+    size_t seekIndex;
+    uint64_t seekGeneration;
+
+    // sorted pts of every frame and of the keyframes, in the stream's time base
+    std::vector<int64_t> framePts;
+    std::vector<int64_t> keyframePts;
+    AVRational timeBase;
+    // recently current frames with their index, references to the decoded frames
+    std::deque<QueuedFrame> scrubFrames;
+    size_t scrubCapacity;
+
+    // streaming upload, the texture last specified and the buffers the frames are unpacked from
+    GLuint uploadedTexture;
+    int textureWidth;
+    int textureHeight;
+    bool mipmaps;
+    std::vector<GLuint> unpackBuffers;
+    size_t nextUnpackBuffer;
+    size_t unpackBufferBytes;
+    // conversion target kept across frames for when an unpack buffer can not be mapped
+    std::vector<uint8_t> rgbFrame;
+
+    // native plane upload, the textures are specified again when the uploaded format or size changes
+    GLuint planeTextures[3];
+    AVPixelFormat planeFormat;
+    int planeWidth;
+    int planeHeight;
+    unsigned int planeUnit;
+    bool planeInterleaved;
+    glm::mat3 planeMatrix;
+    glm::vec3 planeOffset;
+    // plane textures are arrays, one layer without the loop cache and one per frame of the clip with it
+    GLsizei planeLayers;
+    GLint planeLayer;
+    // 8 bit 4:2:0 copy of frames without a native upload
+    SwsContext *planeConverter;
+    AVFrame *planeFrame;
+    // the source the converter's range was last set for, and whether swscale accepted keeping it
+    AVPixelFormat planeConverterFormat;
+    int planeConverterWidth;
+    int planeConverterHeight;
+    bool planeConverterFullRange;
+    bool planeConverterKeepsRange;
+
+    // zero copy decode, get_buffer2 carves frames out of one persistently mapped unpack buffer. a slot the decoder
+    // let go of is only reused once the fence after its last upload passed, the GPU may still be reading it
+    struct DecodeSlot
+    {
+        VideoFrameLoader *owner;
+        size_t index;
+        // render thread only
+        GLsync fence;
+    };
+    GLADloadproc getProcAddress;
+    GLuint slotBuffer;
+    uint8_t *slotMemory;
+    size_t slotBytes;
+    AVPixelFormat slotFormat;
+    std::vector<DecodeSlot> slots;
+    // slots get_buffer2 may hand out, and slots released by the decoder waiting for their fence
+    std::vector<size_t> freeSlots;
+    std::vector<size_t> releasedSlots;
+    std::mutex slotMutex;
+    uint64_t zeroCopyFrames;
+
+    // loop cache, clipFrameEstimate comes from the container and sizes the layers. loopCached is set under the
+    // mutex once every frame of the clip has its layer
+    size_t loopCacheBudget;
+    int64_t clipFrameEstimate;
+    std::vector<bool> cachedLayers;
+    size_t cachedFrames;
+    bool loopCached;
+
+    uint64_t decodedFrames;
+    uint64_t underruns;
+    double decodeSumMilliseconds;
+    double decodeMaxMilliseconds;
+
     AVFormatContext *openVideoFile(const char *filename);
     AVCodecContext *initializeCodecContext(AVFormatContext *formatContext);
-    bool readFrame();
+    void allocateTexture(GLuint textureID, int width, int height);
+    uint8_t *mapUnpackBuffer(size_t bytes);
+    void allocatePlaneTextures(AVPixelFormat format, int width, int height, int chromaShiftX, int chromaShiftY);
+    static bool nativePlanes(AVPixelFormat format, bool &interleaved, int &chromaShiftX, int &chromaShiftY);
+    static void colorConversion(const AVFrame *frame, bool fullRange, glm::mat3 &matrix, glm::vec3 &offset);
+    static size_t slotLayout(AVPixelFormat format, int width, int height, int linesizes[4], size_t offsets[4]);
+    void createSlots(AVPixelFormat format, int width, int height);
+    void recycleSlots();
+    void bindPlaneTextures(unsigned int firstUnit);
+    void completeLoopCache();
+    static int getBuffer(AVCodecContext *context, AVFrame *target, int flags);
+    static void releaseSlot(void *opaque, uint8_t *data);
+    void buildIndex();
+    bool loadIndex(const std::string &indexPath, uint64_t sourceKey);
+    void writeIndex(const std::string &indexPath, uint64_t sourceKey) const;
+    int64_t keyframeBefore(int64_t pts) const;
+    void seekDecoder(int64_t targetPts, int64_t currentPts);
+    void rememberFrame();
+    void decodeLoop();
+    bool decodeFrame(AVFrame *target);
     void reset();
 };
 
-VideoFrameLoader::VideoFrameLoader(const char *videoFileName)
+VideoFrameLoader::VideoFrameLoader(const char *videoFileName, unsigned int queueDepth, GLADloadproc getProcAddress,
+                                   bool indexCache)
+    : frame(nullptr), ended(false), looping(false), stopping(false), clipFrames(0), frameIndex(0), seekPending(false),
+      seekIndex(0), seekGeneration(0), scrubCapacity(0), uploadedTexture(0),
+      textureWidth(0), textureHeight(0), mipmaps(true), nextUnpackBuffer(0), unpackBufferBytes(0), planeTextures{0, 0, 0},
+      planeFormat(AV_PIX_FMT_NONE), planeWidth(0), planeHeight(0), planeUnit(0), planeInterleaved(false), planeMatrix(1.0f),
+      planeOffset(0.0f), planeLayers(1), planeLayer(0), planeConverter(nullptr), planeFrame(nullptr),
+      planeConverterFormat(AV_PIX_FMT_NONE), planeConverterWidth(0), planeConverterHeight(0),
+      planeConverterFullRange(false), planeConverterKeepsRange(false),
+      getProcAddress(getProcAddress), slotBuffer(0), slotMemory(nullptr), slotBytes(0), slotFormat(AV_PIX_FMT_NONE),
+      zeroCopyFrames(0), loopCacheBudget(0), clipFrameEstimate(0), cachedFrames(0), loopCached(false), decodedFrames(0),
+      underruns(0), decodeSumMilliseconds(0.0), decodeMaxMilliseconds(0.0)
 {
     filename = new char[strlen(videoFileName) + 1];
     strcpy(filename, videoFileName);
@@ -49,6 +279,7 @@ VideoFrameLoader::VideoFrameLoader(const char *videoFileName)
     if (!formatContext)
     {
         fprintf(stderr, "Could not open video file.\n");
+        delete[] filename;
         throw std::runtime_error("Could not open video file.");
     }
 
@@ -56,26 +287,98 @@ VideoFrameLoader::VideoFrameLoader(const char *videoFileName)
     if (!codecContext)
     {
         fprintf(stderr, "Could not initialize codec context.\n");
+        delete[] filename;
+        avformat_close_input(&formatContext);
         throw std::runtime_error("Could not initialize codec context.");
     }
 
-    frame = av_frame_alloc();
-
     sws_ctx = sws_getContext(codecContext->width, codecContext->height, codecContext->pix_fmt,
                              codecContext->width, codecContext->height, AV_PIX_FMT_RGB24,
                              SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+    // a cache built from a different version of the file is ignored and rewritten
+    packet = av_packet_alloc();
+    const AVStream *stream = formatContext->streams[videoStreamIndex];
+    timeBase = stream->time_base;
+    const std::string indexPath = std::string(filename) + VIDEO_INDEX_EXTENSION;
+    std::error_code sizeError, timeError;
+    const uint64_t fileSize = std::filesystem::file_size(filename, sizeError);
+    const int64_t modified = std::filesystem::last_write_time(filename, timeError).time_since_epoch().count();
+    uint64_t sourceKey = fnv1aHash(&fileSize, sizeof(fileSize));
+    sourceKey = fnv1aHash(&modified, sizeof(modified), sourceKey);
+    // streams that are no local file are indexed every time
+    indexCache = indexCache && !sizeError && !timeError;
+    if (!indexCache || !loadIndex(indexPath, sourceKey))
+    {
+        buildIndex();
+        if (indexCache)
+        {
+            writeIndex(indexPath, sourceKey);
+        }
+    }
+
+    // frames per pass for sizing the loop cache, counted by the index, the container or worked out from the duration
+    clipFrameEstimate = framePts.empty() ? stream->nb_frames : static_cast<int64_t>(framePts.size());
+    if (clipFrameEstimate <= 0 && stream->duration > 0 && stream->avg_frame_rate.num > 0)
+    {
+        clipFrameEstimate = av_rescale_q(stream->duration, stream->time_base, av_inv_q(stream->avg_frame_rate));
+    }
+
+    // the decoder fills queueDepth frames ahead, one more is held by the render thread
+    queueDepth = queueDepth < 1 ? 1 : queueDepth;
+    for (unsigned int i = 0; i < queueDepth + 1; i++)
+    {
+        framePool.push_back(av_frame_alloc());
+        freeFrames.push_back(framePool.back());
+    }
+    decoder = std::thread(&VideoFrameLoader::decodeLoop, this);
 }
 
 VideoFrameLoader::~VideoFrameLoader()
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameReleased.notify_all();
+    decoder.join();
+
     delete[] filename;
-    av_frame_free(&frame);
+    for (AVFrame *pooled : framePool)
+    {
+        av_frame_free(&pooled);
+    }
+    for (QueuedFrame &scrubbed : scrubFrames)
+    {
+        av_frame_free(&scrubbed.frame);
+    }
+    av_packet_free(&packet);
+    if (!unpackBuffers.empty())
+    {
+        glDeleteBuffers(static_cast<GLsizei>(unpackBuffers.size()), unpackBuffers.data());
+    }
+    if (planeTextures[0])
+    {
+        glDeleteTextures(3, planeTextures);
+    }
+    av_frame_free(&planeFrame);
+    sws_freeContext(planeConverter);
     avcodec_free_context(&codecContext);
     avformat_close_input(&formatContext);
-    avformat_free_context(formatContext);
     sws_freeContext(sws_ctx);
+    // the decoder is gone and has released every slot, the buffer is unmapped with it
+    for (DecodeSlot &slot : slots)
+    {
+        if (slot.fence)
+        {
+            glDeleteSync(slot.fence);
+        }
+    }
+    if (slotBuffer)
+    {
+        glDeleteBuffers(1, &slotBuffer);
+    }
 }
-
 AVFormatContext *VideoFrameLoader::openVideoFile(const char *filename)
 {
     AVFormatContext *formatContext = avformat_alloc_context();
@@ -119,6 +422,15 @@ AVCodecContext *VideoFrameLoader::initializeCodecContext(AVFormatContext *format
     {
         return nullptr;
     }
+    // the decode thread is allowed to fall behind by a few frames, frame threading's extra delay is hidden by the queue
+    codecContext->thread_count = 0;
+    codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    // get_buffer2 falls back to FFmpeg's own buffers until displayPlanes has set up the slots
+    if (getProcAddress)
+    {
+        codecContext->opaque = this;
+        codecContext->get_buffer2 = getBuffer;
+    }
     if (avcodec_open2(codecContext, codec, nullptr) < 0)
     {
         return nullptr;
@@ -126,70 +438,1021 @@ AVCodecContext *VideoFrameLoader::initializeCodecContext(AVFormatContext *format
     return codecContext;
 }
 
+// every video packet's pts and which of them are keyframes, read from the whole file and sorted into
+// presentation order. demuxing only, nothing is decoded
+void VideoFrameLoader::buildIndex()
+{
+    framePts.clear();
+    keyframePts.clear();
+    while (av_read_frame(formatContext, packet) >= 0)
+    {
+        const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        if (packet->stream_index == videoStreamIndex && pts != AV_NOPTS_VALUE)
+        {
+            framePts.push_back(pts);
+            if (packet->flags & AV_PKT_FLAG_KEY)
+            {
+                keyframePts.push_back(pts);
+            }
+        }
+        av_packet_unref(packet);
+    }
+    std::sort(framePts.begin(), framePts.end());
+    std::sort(keyframePts.begin(), keyframePts.end());
+    reset();
+}
+
+bool VideoFrameLoader::loadIndex(const std::string &indexPath, uint64_t sourceKey)
+{
+    std::ifstream in(indexPath, std::ios::binary);
+    VideoIndexHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, VIDEO_INDEX_MAGIC, sizeof(VIDEO_INDEX_MAGIC)) != 0 ||
+        header.version != VIDEO_INDEX_VERSION ||
+        header.sourceKey != sourceKey ||
+        header.streamIndex != static_cast<uint32_t>(videoStreamIndex) ||
+        header.keyframeCount > header.frameCount)
+    {
+        return false;
+    }
+    framePts.resize(header.frameCount);
+    keyframePts.resize(header.keyframeCount);
+    // a truncated file is built again
+    if (!in.read(reinterpret_cast<char *>(framePts.data()), framePts.size() * sizeof(int64_t)) ||
+        !in.read(reinterpret_cast<char *>(keyframePts.data()), keyframePts.size() * sizeof(int64_t)))
+    {
+        framePts.clear();
+        keyframePts.clear();
+        return false;
+    }
+    return true;
+}
+
+void VideoFrameLoader::writeIndex(const std::string &indexPath, uint64_t sourceKey) const
+{
+    VideoIndexHeader header{};
+    memcpy(header.magic, VIDEO_INDEX_MAGIC, sizeof(VIDEO_INDEX_MAGIC));
+    header.version = VIDEO_INDEX_VERSION;
+    header.sourceKey = sourceKey;
+    header.streamIndex = static_cast<uint32_t>(videoStreamIndex);
+    header.frameCount = static_cast<uint32_t>(framePts.size());
+    header.keyframeCount = static_cast<uint32_t>(keyframePts.size());
+
+    // write to a temporary file first so a concurrent reader never sees a half written index
+    const std::string tmpPath = indexPath + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "ERROR::VIDEO_INDEX::COULD_NOT_OPEN " << tmpPath << std::endl;
+        return;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(framePts.data()), framePts.size() * sizeof(int64_t));
+    out.write(reinterpret_cast<const char *>(keyframePts.data()), keyframePts.size() * sizeof(int64_t));
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), indexPath.c_str()) != 0)
+    {
+        std::cout << "ERROR::VIDEO_INDEX::WRITE_FAILED " << indexPath << std::endl;
+        std::remove(tmpPath.c_str());
+    }
+}
+
+// pts of the last keyframe at or before pts, where decoding has to start to show it
+int64_t VideoFrameLoader::keyframeBefore(int64_t pts) const
+{
+    auto after = std::upper_bound(keyframePts.begin(), keyframePts.end(), pts);
+    if (after == keyframePts.begin())
+    {
+        return keyframePts.empty() ? pts : keyframePts.front();
+    }
+    return *(after - 1);
+}
+
 bool VideoFrameLoader::extractFrame(bool loop)
 {
-    if (!loop)
+    std::unique_lock<std::mutex> lock(mutex);
+    // the whole loop is resident, the next frame is only the next layer
+    if (loopCached)
     {
-        return readFrame();
+        if (!loop && frameIndex + 1 >= clipFrames)
+        {
+            return false;
+        }
+        frameIndex = (frameIndex + 1) % clipFrames;
+        return true;
     }
-    else
+    if (loop && !looping)
     {
-        const int readFrameResult = readFrame();
-        if (readFrameResult)
-            return true;
+        looping = true;
+        frameReleased.notify_all();
+    }
+    if (readyFrames.empty() && !ended && !decoderError)
+    {
+        underruns++;
+    }
+    // an ended video still waits when looping, the decoder is about to start over
+    frameReady.wait(lock, [&]()
+                    { return !readyFrames.empty() || decoderError || (ended && !looping); });
+    if (decoderError)
+    {
+        std::rethrow_exception(decoderError);
+    }
+    if (readyFrames.empty())
+    {
+        return false;
+    }
 
-        reset();
-        return readFrame();
+    // the previous frame goes back to the pool, the decoder may fill it again
+    if (frame)
+    {
+        av_frame_unref(frame);
+        freeFrames.push_back(frame);
+        frameReleased.notify_all();
     }
+    frame = readyFrames.front().frame;
+    frameIndex = readyFrames.front().index;
+    readyFrames.pop_front();
+    rememberFrame();
+    return true;
 }
 
-void VideoFrameLoader::displayFrame(GLuint textureID, unsigned int i)
+size_t VideoFrameLoader::frameCount() const
 {
-    int width = frame->width;
-    int height = frame->height;
+    return framePts.size();
+}
+
+bool VideoFrameLoader::seekToFrame(size_t index)
+{
+    if (index >= framePts.size())
+    {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    if (decoderError)
+    {
+        std::rethrow_exception(decoderError);
+    }
+    if (loopCached)
+    {
+        frameIndex = index;
+        return true;
+    }
+
+    // a few frames ahead, the decoder already has them
+    auto queued = std::find_if(readyFrames.begin(), readyFrames.end(), [&](const QueuedFrame &candidate)
+                               { return candidate.index == index; });
+    if (queued != readyFrames.end())
+    {
+        for (auto skipped = readyFrames.begin(); skipped != queued; ++skipped)
+        {
+            av_frame_unref(skipped->frame);
+            freeFrames.push_back(skipped->frame);
+        }
+        readyFrames.erase(readyFrames.begin(), queued);
+        frameReleased.notify_all();
+        lock.unlock();
+        return extractFrame(looping);
+    }
 
-    uint8_t *data[4];
-    int linesize[4];
-    av_image_alloc(data, linesize, width, height, AV_PIX_FMT_RGB24, 1);
+    // everything queued belongs to the old position
+    for (QueuedFrame &stale : readyFrames)
+    {
+        av_frame_unref(stale.frame);
+        freeFrames.push_back(stale.frame);
+    }
+    readyFrames.clear();
+    seekGeneration++;
+    seekPending = true;
+    ended = false;
 
-    sws_scale(sws_ctx, frame->data, frame->linesize, 0, height, data, linesize);
+    // a frame from the scrub cache is current right away, the decoder only has to go on after it
+    auto scrubbed = std::find_if(scrubFrames.begin(), scrubFrames.end(), [&](const QueuedFrame &candidate)
+                                 { return candidate.index == index; });
+    if (scrubbed != scrubFrames.end())
+    {
+        seekIndex = index + 1;
+        frameReleased.notify_all();
+        // the render thread holds no pool frame before the first one, a free one is left with the queue emptied
+        if (!frame)
+        {
+            frame = freeFrames.back();
+            freeFrames.pop_back();
+        }
+        av_frame_unref(frame);
+        av_frame_ref(frame, scrubbed->frame);
+        frameIndex = index;
+        return true;
+    }
 
-    glActiveTexture(GL_TEXTURE0 + i);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data[0]);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    seekIndex = index;
+    frameReleased.notify_all();
+    lock.unlock();
+    return extractFrame(looping);
+}
 
+bool VideoFrameLoader::seekToTime(double seconds)
+{
+    if (framePts.empty())
+    {
+        return false;
+    }
+    // the last frame starting at or before the time
+    const int64_t pts = framePts.front() + static_cast<int64_t>(std::floor(seconds / av_q2d(timeBase)));
+    const size_t after = std::upper_bound(framePts.begin(), framePts.end(), pts) - framePts.begin();
+    return seekToFrame(after > 0 ? after - 1 : 0);
+}
+
+void VideoFrameLoader::setScrubCache(size_t frames)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    scrubCapacity = frames;
+    while (scrubFrames.size() > scrubCapacity)
+    {
+        av_frame_free(&scrubFrames.front().frame);
+        scrubFrames.pop_front();
+    }
+}
+
+// keeps a reference to the new current frame, the oldest one makes room
+void VideoFrameLoader::rememberFrame()
+{
+    if (!scrubCapacity || std::any_of(scrubFrames.begin(), scrubFrames.end(), [&](const QueuedFrame &scrubbed)
+                                      { return scrubbed.index == frameIndex; }))
+    {
+        return;
+    }
+    if (scrubFrames.size() == scrubCapacity)
+    {
+        av_frame_free(&scrubFrames.front().frame);
+        scrubFrames.pop_front();
+    }
+    scrubFrames.push_back(QueuedFrame{av_frame_clone(frame), frameIndex});
+}
+
+VideoDecodeStats VideoFrameLoader::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return VideoDecodeStats{readyFrames.size(), framePool.size() - 1, decodedFrames, underruns,
+                            decodedFrames > 0 ? decodeSumMilliseconds / decodedFrames : 0.0, decodeMaxMilliseconds,
+                            zeroCopyFrames, cachedFrames};
+}
+
+void VideoFrameLoader::setMipmaps(bool enabled)
+{
+    if (enabled != mipmaps)
+    {
+        mipmaps = enabled;
+        // the filters change, the next frame specifies the textures again
+        uploadedTexture = 0;
+        planeFormat = AV_PIX_FMT_NONE;
+    }
+}
+
+void VideoFrameLoader::allocateTexture(GLuint textureID, int width, int height)
+{
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    av_freep(&data[0]);
+    uploadedTexture = textureID;
+    textureWidth = width;
+    textureHeight = height;
 }
 
-bool VideoFrameLoader::readFrame()
+// binds the next buffer of the ring and maps `bytes` of it for writing, null if the driver refuses.
+// three buffers, the driver may still be copying out of the last two while the next one is written
+uint8_t *VideoFrameLoader::mapUnpackBuffer(size_t bytes)
 {
-    AVPacket *packet = av_packet_alloc();
+    if (unpackBuffers.empty())
+    {
+        unpackBuffers.resize(3);
+        glGenBuffers(static_cast<GLsizei>(unpackBuffers.size()), unpackBuffers.data());
+    }
+    if (bytes != unpackBufferBytes)
+    {
+        for (GLuint buffer : unpackBuffers)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        }
+        unpackBufferBytes = bytes;
+    }
 
-    while (av_read_frame(formatContext, packet) >= 0)
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffers[nextUnpackBuffer]);
+    nextUnpackBuffer = (nextUnpackBuffer + 1) % unpackBuffers.size();
+    // invalidating lets the driver hand out fresh memory if the buffer's last upload is still pending
+    return static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+}
+
+void VideoFrameLoader::displayFrame(GLuint textureID, unsigned int i)
+{
+    const int width = frame->width;
+    const int height = frame->height;
+
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    if (textureID != uploadedTexture || width != textureWidth || height != textureHeight)
     {
-        if (packet->stream_index == videoStreamIndex)
+        allocateTexture(textureID, width, height);
+    }
+
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    // rows of RGB24 are not 4 byte aligned for every width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    const size_t frameBytes = size_t(width) * height * 3;
+    int linesize[4] = {width * 3, 0, 0, 0};
+    uint8_t *mapped = mapUnpackBuffer(frameBytes);
+    bool uploaded = false;
+    if (mapped)
+    {
+        uint8_t *data[4] = {mapped, nullptr, nullptr, nullptr};
+        sws_scale(sws_ctx, frame->data, frame->linesize, 0, height, data, linesize);
+        // the contents are undefined if the buffer was lost while mapped
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            uploaded = true;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!uploaded)
+    {
+        rgbFrame.resize(frameBytes);
+        uint8_t *data[4] = {rgbFrame.data(), nullptr, nullptr, nullptr};
+        sws_scale(sws_ctx, frame->data, frame->linesize, 0, height, data, linesize);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgbFrame.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    if (mipmaps)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+// 8 bit planar and NV12 formats the GPU can sample as they are
+bool VideoFrameLoader::nativePlanes(AVPixelFormat format, bool &interleaved, int &chromaShiftX, int &chromaShiftY)
+{
+    interleaved = format == AV_PIX_FMT_NV12;
+    switch (format)
+    {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_NV12:
+        chromaShiftX = 1;
+        chromaShiftY = 1;
+        return true;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+        chromaShiftX = 1;
+        chromaShiftY = 0;
+        return true;
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        chromaShiftX = 0;
+        chromaShiftY = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// YCbCr to RGB for the frame's matrix and range as rgb = matrix * (yuv - offset), every component in [0, 1]
+void VideoFrameLoader::colorConversion(const AVFrame *frame, bool fullRange, glm::mat3 &matrix, glm::vec3 &offset)
+{
+    // luma weights of red and blue. untagged video is BT.601 below HD and BT.709 from 720p up, as most players assume
+    float kr = 0.2126f, kb = 0.0722f;
+    if (frame->colorspace == AVCOL_SPC_BT470BG || frame->colorspace == AVCOL_SPC_SMPTE170M ||
+        (frame->colorspace == AVCOL_SPC_UNSPECIFIED && frame->height < 720))
+    {
+        kr = 0.299f;
+        kb = 0.114f;
+    }
+    else if (frame->colorspace == AVCOL_SPC_BT2020_NCL)
+    {
+        kr = 0.2627f;
+        kb = 0.0593f;
+    }
+    const float kg = 1.0f - kr - kb;
+
+    // limited range puts black at 16 and white at 235, chroma spans 16 to 240
+    const float lumaScale = fullRange ? 1.0f : 255.0f / 219.0f;
+    const float chromaScale = fullRange ? 1.0f : 255.0f / 224.0f;
+    // glm matrices are column major, one column per Y, Cb and Cr
+    matrix[0] = glm::vec3(lumaScale);
+    matrix[1] = glm::vec3(0.0f, -2.0f * kb * (1.0f - kb) / kg, 2.0f * (1.0f - kb)) * chromaScale;
+    matrix[2] = glm::vec3(2.0f * (1.0f - kr), -2.0f * kr * (1.0f - kr) / kg, 0.0f) * chromaScale;
+    offset = glm::vec3(fullRange ? 0.0f : 16.0f / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f);
+}
+
+void VideoFrameLoader::allocatePlaneTextures(AVPixelFormat format, int width, int height, int chromaShiftX, int chromaShiftY)
+{
+    if (!planeTextures[0])
+    {
+        glGenTextures(3, planeTextures);
+    }
+    const int planes = planeInterleaved ? 2 : 3;
+    const int chromaW = (width + (1 << chromaShiftX) - 1) >> chromaShiftX;
+    const int chromaH = (height + (1 << chromaShiftY) - 1) >> chromaShiftY;
+
+    // a layer per frame when the clip fits the budget, with some slack as container durations are rounded.
+    // allocating again halfway through filling the cache, e.g. on a size change, gives up on it
+    planeLayers = 1;
+    if (loopCacheBudget && cachedFrames == 0 && clipFrameEstimate > 0)
+    {
+        const size_t layers = size_t(clipFrameEstimate) + size_t(clipFrameEstimate) / 50 + 2;
+        size_t layerBytes = size_t(width) * height + size_t(chromaW) * chromaH * 2;
+        // the mip chain adds a third
+        layerBytes += mipmaps ? layerBytes / 3 : 0;
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        if (layers * layerBytes <= loopCacheBudget && layers <= size_t(maxLayers))
+        {
+            planeLayers = static_cast<GLsizei>(layers);
+        }
+    }
+    if (planeLayers == 1)
+    {
+        loopCacheBudget = 0;
+    }
+    cachedLayers.assign(planeLayers > 1 ? planeLayers : 0, false);
+    cachedFrames = 0;
+
+    for (int plane = 0; plane < planes; plane++)
+    {
+        const int planeW = plane == 0 ? width : chromaW;
+        const int planeH = plane == 0 ? height : chromaH;
+        const bool uv = planeInterleaved && plane == 1;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, planeTextures[plane]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, uv ? GL_RG8 : GL_R8, planeW, planeH, planeLayers, 0, uv ? GL_RG : GL_RED,
+                     GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // while the cache fills only the base level is complete, the mip chain is built once every layer is in
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, planeLayers > 1 ? 0 : 1000);
+    }
+    planeFormat = format;
+    planeWidth = width;
+    planeHeight = height;
+}
+
+// plane layout of a decoder buffer for a width x height picture, returns its size. like FFmpeg's own buffers every
+// row is a multiple of 64 bytes and every plane is followed by padding the decoder's SIMD code may read into
+size_t VideoFrameLoader::slotLayout(AVPixelFormat format, int width, int height, int linesizes[4], size_t offsets[4])
+{
+    bool interleaved;
+    int chromaShiftX, chromaShiftY;
+    nativePlanes(format, interleaved, chromaShiftX, chromaShiftY);
+    // widening by the lowest set bit keeps the chroma rows exactly as long as the decoder expects from the luma rows
+    bool unaligned;
+    do
+    {
+        av_image_fill_linesizes(linesizes, format, width);
+        width += width & ~(width - 1);
+        unaligned = false;
+        for (int plane = 0; plane < 4; plane++)
+        {
+            unaligned = unaligned || linesizes[plane] % 64 != 0;
+        }
+    } while (unaligned);
+
+    size_t bytes = 0;
+    for (int plane = 0; plane < 4; plane++)
+    {
+        const int rows = plane == 0 ? height : (height + (1 << chromaShiftY) - 1) >> chromaShiftY;
+        offsets[plane] = bytes;
+        if (linesizes[plane])
+        {
+            bytes += FFALIGN(size_t(linesizes[plane]) * rows + 16 + 64, size_t(64));
+        }
+    }
+    return bytes;
+}
+
+// one attempt on the first native frame, a context without buffer storage keeps copying
+void VideoFrameLoader::createSlots(AVPixelFormat format, int width, int height)
+{
+    GLADloadproc loader = getProcAddress;
+    getProcAddress = nullptr;
+
+    GLint major = 0, minor = 0, count = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 4);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count && !supported; i++)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        supported = name && strcmp(name, "GL_ARB_buffer_storage") == 0;
+    }
+    PFNVIDEOBUFFERSTORAGEPROC bufferStorage =
+        supported ? reinterpret_cast<PFNVIDEOBUFFERSTORAGEPROC>(loader("glBufferStorage")) : nullptr;
+    if (!bufferStorage)
+    {
+        return;
+    }
+
+    // besides the queued frames the decoder holds its reference frames and one picture per frame thread.
+    // running short only means some frames come from FFmpeg's pool and are copied as before
+    const size_t slotCount = framePool.size() + 16;
+    // the slots are sized for the largest padding a decoder asks for, getBuffer checks the actual request
+    int linesizes[4];
+    size_t offsets[4];
+    const size_t bytes = slotLayout(format, FFALIGN(width, 64) + 64, FFALIGN(height, 64) + 64, linesizes, offsets);
+    // the decoder reads its reference frames back, client storage asks for cached system memory instead of write
+    // combined memory that is slow to read. mappings are at least 64 byte aligned and so is every slot
+    const GLbitfield access = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    bufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes * slotCount, nullptr, access | GL_CLIENT_STORAGE_BIT);
+    uint8_t *memory = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes * slotCount, access));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!memory)
+    {
+        glDeleteBuffers(1, &buffer);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(slotMutex);
+    slotBuffer = buffer;
+    slotMemory = memory;
+    slotBytes = bytes;
+    slotFormat = format;
+    slots.resize(slotCount);
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        slots[i] = DecodeSlot{this, i, nullptr};
+        freeSlots.push_back(i);
+    }
+}
+
+// slots the decoder released go back to it once the GPU finished their last upload, never waits
+void VideoFrameLoader::recycleSlots()
+{
+    std::lock_guard<std::mutex> lock(slotMutex);
+    for (size_t i = 0; i < releasedSlots.size();)
+    {
+        DecodeSlot &slot = slots[releasedSlots[i]];
+        if (slot.fence)
+        {
+            if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                i++;
+                continue;
+            }
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        freeSlots.push_back(slot.index);
+        releasedSlots[i] = releasedSlots.back();
+        releasedSlots.pop_back();
+    }
+}
+
+// get_buffer2, called from the decoder's threads. it must not wait for the render thread, which may itself be
+// waiting in extractFrame, so without a free slot the frame gets one of FFmpeg's buffers instead
+int VideoFrameLoader::getBuffer(AVCodecContext *context, AVFrame *target, int flags)
+{
+    VideoFrameLoader *loader = static_cast<VideoFrameLoader *>(context->opaque);
+    int width = target->width, height = target->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    int linesizes[4];
+    size_t offsets[4];
+    {
+        std::lock_guard<std::mutex> lock(loader->slotMutex);
+        if (!loader->freeSlots.empty() && target->format == loader->slotFormat &&
+            (context->codec->capabilities & AV_CODEC_CAP_DR1))
         {
-            if (avcodec_send_packet(codecContext, packet) >= 0)
+            avcodec_align_dimensions2(context, &width, &height, linesizeAlign);
+            if (slotLayout(loader->slotFormat, width, height, linesizes, offsets) <= loader->slotBytes)
             {
-                if (avcodec_receive_frame(codecContext, frame) >= 0)
+                DecodeSlot &slot = loader->slots[loader->freeSlots.back()];
+                uint8_t *memory = loader->slotMemory + slot.index * loader->slotBytes;
+                target->buf[0] = av_buffer_create(memory, loader->slotBytes, releaseSlot, &slot, 0);
+                if (target->buf[0])
                 {
-                    av_packet_unref(packet);
-                    av_packet_free(&packet);
-                    return true;
+                    loader->freeSlots.pop_back();
+                    for (int plane = 0; plane < 4; plane++)
+                    {
+                        target->data[plane] = linesizes[plane] ? memory + offsets[plane] : nullptr;
+                        target->linesize[plane] = linesizes[plane];
+                    }
+                    target->extended_data = target->data;
+                    return 0;
                 }
             }
         }
+    }
+    return avcodec_default_get_buffer2(context, target, flags);
+}
+
+// the last reference to a slot's frame is gone, from whichever thread dropped it
+void VideoFrameLoader::releaseSlot(void *opaque, uint8_t *)
+{
+    DecodeSlot *slot = static_cast<DecodeSlot *>(opaque);
+    std::lock_guard<std::mutex> lock(slot->owner->slotMutex);
+    slot->owner->releasedSlots.push_back(slot->index);
+}
+
+void VideoFrameLoader::bindPlaneTextures(unsigned int firstUnit)
+{
+    for (int plane = 0; plane < (planeInterleaved ? 2 : 3); plane++)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + plane);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, planeTextures[plane]);
+    }
+}
+
+// once every frame of the clip has its layer the decoder stops, the frames it queued go back to the pool
+void VideoFrameLoader::completeLoopCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!clipFrames || cachedFrames < clipFrames)
+        {
+            return;
+        }
+        loopCached = true;
+        for (QueuedFrame &queued : readyFrames)
+        {
+            av_frame_unref(queued.frame);
+            freeFrames.push_back(queued.frame);
+        }
+        readyFrames.clear();
+    }
+    if (mipmaps)
+    {
+        for (int plane = 0; plane < (planeInterleaved ? 2 : 3); plane++)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, planeTextures[plane]);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 1000);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+    }
+}
+
+void VideoFrameLoader::setLoopCache(size_t budgetBytes)
+{
+    loopCacheBudget = budgetBytes;
+    // the textures are specified again for the next frame
+    planeFormat = AV_PIX_FMT_NONE;
+}
+
+void VideoFrameLoader::displayPlanes(unsigned int firstUnit)
+{
+    // a frame already in the loop cache only selects its layer
+    if (loopCached || (frameIndex < cachedLayers.size() && cachedLayers[frameIndex]))
+    {
+        planeUnit = firstUnit;
+        planeLayer = static_cast<GLint>(frameIndex);
+        bindPlaneTextures(firstUnit);
+        if (!loopCached)
+        {
+            completeLoopCache();
+        }
+        return;
+    }
+
+    const AVFrame *source = frame;
+    const int width = frame->width;
+    const int height = frame->height;
+    AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+    bool fullRange = frame->color_range == AVCOL_RANGE_JPEG || format == AV_PIX_FMT_YUVJ420P ||
+                     format == AV_PIX_FMT_YUVJ422P || format == AV_PIX_FMT_YUVJ444P;
+    bool interleaved;
+    int chromaShiftX, chromaShiftY;
+    if (!nativePlanes(format, interleaved, chromaShiftX, chromaShiftY))
+    {
+        SwsContext *converter = sws_getCachedContext(planeConverter, width, height, format, width, height,
+                                                     AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        // the planes keep the source's range, the shader expands it with the matrix below. swscale would otherwise
+        // take the range from the pixel format, which is wrong for full range streams tagged only by color_range.
+        // setting it rebuilds the converter's tables, so only for a new context or source. a replaced context can
+        // come back at the freed one's address, the source is compared as well
+        if (converter != planeConverter || format != planeConverterFormat || width != planeConverterWidth ||
+            height != planeConverterHeight || fullRange != planeConverterFullRange)
+        {
+            const int *coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+            planeConverterKeepsRange = sws_setColorspaceDetails(converter, coefficients, fullRange, coefficients,
+                                                                fullRange, 0, 1 << 16, 1 << 16) >= 0;
+            planeConverterFormat = format;
+            planeConverterWidth = width;
+            planeConverterHeight = height;
+            planeConverterFullRange = fullRange;
+        }
+        planeConverter = converter;
+        if (!planeFrame)
+        {
+            planeFrame = av_frame_alloc();
+        }
+        if (planeFrame->width != width || planeFrame->height != height)
+        {
+            av_frame_unref(planeFrame);
+            planeFrame->format = AV_PIX_FMT_YUV420P;
+            planeFrame->width = width;
+            planeFrame->height = height;
+            if (av_frame_get_buffer(planeFrame, 0) < 0)
+            {
+                throw std::runtime_error("Failed to allocate video planes.");
+            }
+        }
+        sws_scale(planeConverter, frame->data, frame->linesize, 0, height, planeFrame->data, planeFrame->linesize);
+        source = planeFrame;
+        format = AV_PIX_FMT_YUV420P;
+        // without the range setting swscale writes its default, limited range
+        fullRange = fullRange && planeConverterKeepsRange;
+        nativePlanes(format, interleaved, chromaShiftX, chromaShiftY);
+    }
+
+    // the slots are set up on the first native frame, the decoder writes the ones after it straight into them
+    if (getProcAddress && source == frame)
+    {
+        createSlots(format, width, height);
+    }
+    DecodeSlot *slot = nullptr;
+    if (slotBuffer)
+    {
+        recycleSlots();
+        const uintptr_t start = reinterpret_cast<uintptr_t>(slotMemory);
+        const uintptr_t address = reinterpret_cast<uintptr_t>(source->data[0]);
+        if (address >= start && address < start + slots.size() * slotBytes)
+        {
+            slot = &slots[(address - start) / slotBytes];
+        }
+    }
+
+    planeUnit = firstUnit;
+    planeInterleaved = interleaved;
+    colorConversion(frame, fullRange, planeMatrix, planeOffset);
+    if (format != planeFormat || width != planeWidth || height != planeHeight)
+    {
+        allocatePlaneTextures(format, width, height, chromaShiftX, chromaShiftY);
+    }
+    // with the loop cache every frame goes into its own layer, a clip longer than estimated gives up on the cache
+    if (planeLayers > 1 && frameIndex >= size_t(planeLayers))
+    {
+        loopCacheBudget = 0;
+        allocatePlaneTextures(format, width, height, chromaShiftX, chromaShiftY);
+    }
+    planeLayer = planeLayers > 1 ? static_cast<GLint>(frameIndex) : 0;
+
+    const int planes = interleaved ? 2 : 3;
+    int rows[3];
+    size_t offsets[3];
+    size_t bytes = 0;
+    for (int plane = 0; plane < planes; plane++)
+    {
+        rows[plane] = plane == 0 ? height : (height + (1 << chromaShiftY) - 1) >> chromaShiftY;
+        offsets[plane] = bytes;
+        bytes += size_t(source->linesize[plane]) * rows[plane];
+    }
+
+    GLint unpackAlignment, unpackRowLength;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &unpackRowLength);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // the planes go into the buffer with the decoder's padding, the row length skips it during the upload.
+    // a frame decoded into a slot already is in an unpack buffer, its planes are uploaded from where they are
+    uint8_t *mapped = slot ? nullptr : mapUnpackBuffer(bytes);
+    if (mapped)
+    {
+        for (int plane = 0; plane < planes; plane++)
+        {
+            memcpy(mapped + offsets[plane], source->data[plane], size_t(source->linesize[plane]) * rows[plane]);
+        }
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+        {
+            mapped = nullptr;
+        }
+    }
+    // without a buffer the driver copies straight from the frame, which stays valid until the next extractFrame
+    if (slot)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slotBuffer);
+    }
+    else if (!mapped)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    for (int plane = 0; plane < planes; plane++)
+    {
+        const bool uv = interleaved && plane == 1;
+        const int planeW = plane == 0 ? width : (width + (1 << chromaShiftX) - 1) >> chromaShiftX;
+        const uint8_t *pixels = slot     ? reinterpret_cast<const uint8_t *>(source->data[plane] - slotMemory)
+                                : mapped ? reinterpret_cast<const uint8_t *>(offsets[plane])
+                                         : source->data[plane];
+        glActiveTexture(GL_TEXTURE0 + firstUnit + plane);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, planeTextures[plane]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, source->linesize[plane] / (uv ? 2 : 1));
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, planeLayer, planeW, rows[plane], 1, uv ? GL_RG : GL_RED,
+                        GL_UNSIGNED_BYTE, pixels);
+        if (mipmaps && planeLayers == 1)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+    }
+    // the slot is not handed to the decoder again before the GPU is done reading it
+    if (slot)
+    {
+        if (slot->fence)
+        {
+            glDeleteSync(slot->fence);
+        }
+        slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        zeroCopyFrames++;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, unpackRowLength);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    if (planeLayers > 1)
+    {
+        cachedLayers[planeLayer] = true;
+        cachedFrames++;
+        completeLoopCache();
+    }
+}
+
+void VideoFrameLoader::setPlaneUniforms(const Shader &shader, const std::string &name) const
+{
+    shader.setInt(name + ".y", planeUnit);
+    shader.setInt(name + ".u", planeUnit + 1);
+    // NV12 has no third plane, the sampler still needs a unit of its own type
+    shader.setInt(name + ".v", planeUnit + (planeInterleaved ? 1 : 2));
+    shader.setBool(name + ".interleaved", planeInterleaved);
+    shader.setFloat(name + ".layer", static_cast<float>(planeLayer));
+    shader.setMat3(name + ".matrix", planeMatrix);
+    shader.setVec3(name + ".offset", planeOffset);
+}
+
+void VideoFrameLoader::decodeLoop()
+{
+    try
+    {
+        // frames since the last start over, a looping video without a single frame would start over forever
+        size_t decodedSinceReset = 0;
+        // pts of the last decoded frame, and the seek target the frames before are decoded but not queued for
+        int64_t decodedPts = AV_NOPTS_VALUE;
+        int64_t skipBeforePts = AV_NOPTS_VALUE;
+        while (true)
+        {
+            AVFrame *target = nullptr;
+            uint64_t generation;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // with the whole loop in the cache there is nothing left to decode
+                frameReleased.wait(lock, [&]()
+                                   { return stopping || seekPending ||
+                                            (!loopCached && ((!ended && !freeFrames.empty()) || (ended && looping))); });
+                if (stopping)
+                {
+                    return;
+                }
+                if (seekPending)
+                {
+                    // a drained decoder takes no more packets, it has to seek even inside the GOP
+                    const bool drained = ended;
+                    const size_t index = seekIndex;
+                    seekPending = false;
+                    // nothing comes after the last frame, an extractFrame waiting for one returns
+                    ended = index >= framePts.size();
+                    if (ended)
+                    {
+                        frameReady.notify_all();
+                    }
+                    lock.unlock();
+                    if (index < framePts.size())
+                    {
+                        skipBeforePts = framePts[index];
+                        seekDecoder(skipBeforePts, drained ? AV_NOPTS_VALUE : decodedPts);
+                        decodedSinceReset = index;
+                    }
+                    continue;
+                }
+                if (ended)
+                {
+                    if (!decodedSinceReset)
+                    {
+                        throw std::runtime_error("Video has no frames to loop.");
+                    }
+                    ended = false;
+                    decodedSinceReset = 0;
+                    decodedPts = AV_NOPTS_VALUE;
+                    lock.unlock();
+                    reset();
+                    continue;
+                }
+                target = freeFrames.back();
+                freeFrames.pop_back();
+                generation = seekGeneration;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const bool decoded = decodeFrame(target);
+            const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            // a seek came in while decoding, the frame belongs to the old position. the decoder moved on all the same,
+            // past the end it has to seek in any case
+            if (generation != seekGeneration)
+            {
+                decodedPts = decoded ? target->best_effort_timestamp : AV_NOPTS_VALUE;
+                av_frame_unref(target);
+                freeFrames.push_back(target);
+                continue;
+            }
+            if (decoded)
+            {
+                decodedFrames++;
+                decodeSumMilliseconds += milliseconds;
+                decodeMaxMilliseconds = milliseconds > decodeMaxMilliseconds ? milliseconds : decodeMaxMilliseconds;
+                decodedPts = target->best_effort_timestamp;
+                // on the way from the keyframe to the seek target
+                if (skipBeforePts != AV_NOPTS_VALUE && decodedPts != AV_NOPTS_VALUE && decodedPts < skipBeforePts)
+                {
+                    av_frame_unref(target);
+                    freeFrames.push_back(target);
+                    continue;
+                }
+                skipBeforePts = AV_NOPTS_VALUE;
+                readyFrames.push_back(QueuedFrame{target, decodedSinceReset++});
+            }
+            else
+            {
+                freeFrames.push_back(target);
+                ended = true;
+                clipFrames = decodedSinceReset;
+            }
+            frameReady.notify_all();
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoderError = std::current_exception();
+        frameReady.notify_all();
+    }
+}
+
+// reads packets until the decoder returns the next frame, false once the decoder is drained at the end of the file
+bool VideoFrameLoader::decodeFrame(AVFrame *target)
+{
+    while (true)
+    {
+        const int received = avcodec_receive_frame(codecContext, target);
+        if (received == 0)
+        {
+            return true;
+        }
+        if (received == AVERROR_EOF)
+        {
+            return false;
+        }
+        if (received != AVERROR(EAGAIN))
+        {
+            throw std::runtime_error("Error while decoding video frame.");
+        }
+
+        if (av_read_frame(formatContext, packet) < 0)
+        {
+            // a null packet drains the frames still buffered by the decoder's threads and reordering
+            avcodec_send_packet(codecContext, nullptr);
+            continue;
+        }
+        // a damaged packet only costs its own frame
+        if (packet->stream_index == videoStreamIndex)
+        {
+            avcodec_send_packet(codecContext, packet);
+        }
         av_packet_unref(packet);
     }
+}
 
-    av_packet_free(&packet);
-    return false;
+// positions the demuxer and decoder for targetPts at the closest keyframe before it. scrubbing forward within
+// the GOP the decoder is in goes on decoding instead, the frames in between cost less than starting over
+void VideoFrameLoader::seekDecoder(int64_t targetPts, int64_t currentPts)
+{
+    const int64_t keyframe = keyframeBefore(targetPts);
+    if (currentPts != AV_NOPTS_VALUE && currentPts < targetPts && keyframeBefore(currentPts) == keyframe)
+    {
+        return;
+    }
+    if (av_seek_frame(formatContext, videoStreamIndex, keyframe, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        throw std::runtime_error("Error seeking in the video.");
+    }
+    avcodec_flush_buffers(codecContext);
 }
 
 void VideoFrameLoader::reset()
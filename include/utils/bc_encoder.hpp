@@ -0,0 +1,242 @@
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// cpu block compression for the offline texture converter, runs without any GL context.
+// endpoints come from the inset bounding box of each 4x4 block, which is fast and good enough
+// for diffuse/specular maps; BC7 is not encoded here, such files have to come from external tools.
+enum EBlockFormat
+{
+    EBlockFormat_BC1,
+    EBlockFormat_BC3,
+    EBlockFormat_BC5,
+};
+
+unsigned int blockFormatBytes(EBlockFormat format)
+{
+    return format == EBlockFormat_BC1 ? 8 : 16;
+}
+
+uint16_t packColor565(const int color[3])
+{
+    return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 |
+                                 ((color[1] * 63 + 127) / 255) << 5 |
+                                 ((color[2] * 31 + 127) / 255));
+}
+
+void unpackColor565(uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// 16 RGBA texels in, 8 bytes out
+void encodeBC1Block(const uint8_t texels[16][4], uint8_t *out)
+{
+    int minColor[3] = {255, 255, 255}, maxColor[3] = {0, 0, 0};
+    int mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            minColor[c] = std::min(minColor[c], int(texels[i][c]));
+            maxColor[c] = std::max(maxColor[c], int(texels[i][c]));
+            mean[c] += texels[i][c];
+        }
+    }
+
+    // pick the box diagonal that follows the colors: flip green/blue when they fall as red rises
+    int covRG = 0, covRB = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int r = texels[i][0] * 16 - mean[0];
+        covRG += r * (texels[i][1] * 16 - mean[1]);
+        covRB += r * (texels[i][2] * 16 - mean[2]);
+    }
+    if (covRG < 0)
+    {
+        std::swap(minColor[1], maxColor[1]);
+    }
+    if (covRB < 0)
+    {
+        std::swap(minColor[2], maxColor[2]);
+    }
+
+    // inset the box a little so the endpoints are not dominated by outliers
+    for (int c = 0; c < 3; c++)
+    {
+        int inset = (maxColor[c] - minColor[c]) / 16;
+        maxColor[c] -= inset;
+        minColor[c] += inset;
+    }
+
+    uint16_t color0 = packColor565(maxColor);
+    uint16_t color1 = packColor565(minColor);
+    // color0 > color1 selects the opaque four color mode
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+    }
+
+    int palette[4][3];
+    unpackColor565(color0, palette[0]);
+    unpackColor565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 4; p++)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    int d = int(texels[i][c]) - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    best = p;
+                    bestError = error;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    memcpy(out + 4, &indices, sizeof(indices));
+}
+
+// one channel of 16 texels in, 8 bytes out, used for BC3 alpha and both BC5 channels
+void encodeBC4Block(const uint8_t values[16], uint8_t *out)
+{
+    int maxValue = *std::max_element(values, values + 16);
+    int minValue = *std::min_element(values, values + 16);
+
+    // value0 > value1 selects the eight value interpolation mode
+    int palette[8];
+    palette[0] = maxValue;
+    palette[1] = minValue;
+    for (int i = 1; i < 7; i++)
+    {
+        palette[i + 1] = ((7 - i) * maxValue + i * minValue) / 7;
+    }
+
+    uint64_t indices = 0;
+    if (maxValue != minValue)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 8; p++)
+            {
+                int error = std::abs(int(values[i]) - palette[p]);
+                if (error < bestError)
+                {
+                    best = p;
+                    bestError = error;
+                }
+            }
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+
+    out[0] = static_cast<uint8_t>(maxValue);
+    out[1] = static_cast<uint8_t>(minValue);
+    for (int i = 0; i < 6; i++)
+    {
+        out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+    }
+}
+
+void encodeBlock(EBlockFormat format, const uint8_t texels[16][4], uint8_t *out)
+{
+    uint8_t channel[16];
+    switch (format)
+    {
+    case EBlockFormat_BC1:
+        encodeBC1Block(texels, out);
+        break;
+    case EBlockFormat_BC3:
+        for (int i = 0; i < 16; i++)
+            channel[i] = texels[i][3];
+        encodeBC4Block(channel, out);
+        encodeBC1Block(texels, out + 8);
+        break;
+    case EBlockFormat_BC5:
+        for (int i = 0; i < 16; i++)
+            channel[i] = texels[i][0];
+        encodeBC4Block(channel, out);
+        for (int i = 0; i < 16; i++)
+            channel[i] = texels[i][1];
+        encodeBC4Block(channel, out + 8);
+        break;
+    }
+}
+
+// compress a tightly packed RGBA8 image, partial edge blocks repeat the last row/column
+std::vector<uint8_t> compressImage(const uint8_t *rgba, int width, int height, EBlockFormat format)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    const unsigned int blockBytes = blockFormatBytes(format);
+    std::vector<uint8_t> blocks(size_t(blocksX) * blocksY * blockBytes);
+
+    uint8_t texels[16][4];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int x = std::min(bx * 4 + i % 4, width - 1);
+                int y = std::min(by * 4 + i / 4, height - 1);
+                memcpy(texels[i], rgba + (size_t(y) * width + x) * 4, 4);
+            }
+            encodeBlock(format, texels, blocks.data() + (size_t(by) * blocksX + bx) * blockBytes);
+        }
+    }
+    return blocks;
+}
+
+// 2x2 box filter of an RGBA8 image, odd sizes fold the last row/column in
+std::vector<uint8_t> downsampleImage(const uint8_t *rgba, int width, int height, int &outWidth, int &outHeight)
+{
+    outWidth = std::max(1, width / 2);
+    outHeight = std::max(1, height / 2);
+    std::vector<uint8_t> result(size_t(outWidth) * outHeight * 4);
+    for (int y = 0; y < outHeight; y++)
+    {
+        for (int x = 0; x < outWidth; x++)
+        {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int c = 0; c < 4; c++)
+            {
+                int sum = rgba[(size_t(y0) * width + x0) * 4 + c] + rgba[(size_t(y0) * width + x1) * 4 + c] +
+                          rgba[(size_t(y1) * width + x0) * 4 + c] + rgba[(size_t(y1) * width + x1) * 4 + c];
+                result[(size_t(y) * outWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,323 @@
+#ifndef CAPTURE_FANOUT_H
+#define CAPTURE_FANOUT_H
+
+#include <utils/screen_capture.hpp>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct CaptureOutput
+{
+    std::string path;
+    EScreenCaptureFormat format;
+    // 0 keeps the size of the captured frames
+    unsigned int width;
+    unsigned int height;
+    unsigned int frameRate;
+    // encode every n-th captured frame, e.g. 2 for a 30fps preview of a 60fps render
+    unsigned int decimation;
+    AVCodecID codec;
+};
+
+// hands one stream of captured YUV420P frames to any number of encoders, each with its own size, codec,
+// container and frame rate. outputs of the same size form a group: a group that needs scaling copies the
+// frame once on the render thread and scales it once on its own thread for all of its outputs, outputs at
+// the captured size take the frame as it is.
+class CaptureFanout
+{
+public:
+    // size of the frames passed to submit()
+    CaptureFanout(unsigned int width, unsigned int height);
+    ~CaptureFanout();
+    CaptureFanout(const CaptureFanout &) = delete;
+    CaptureFanout &operator=(const CaptureFanout &) = delete;
+
+    // outputs are fixed once the first frame was submitted, returns the index for stats()
+    size_t addOutput(const CaptureOutput &output);
+    // tightly packed Y, U and V planes, top row first, e.g. from a YuvConversionPass
+    void submit(const uint8_t *data);
+    size_t outputCount() const;
+    ScreenCaptureStats stats(size_t output) const;
+    void release();
+
+private:
+    struct Output
+    {
+        unsigned int decimation;
+        std::unique_ptr<ScreenCapture> capture;
+    };
+
+    struct Group
+    {
+        unsigned int width;
+        unsigned int height;
+        std::vector<Output *> outputs;
+        // null when the group takes the captured size
+        SwsContext *scaler;
+        std::vector<uint8_t> scaled;
+
+        // frames waiting for the scaler, copies owned by framePool
+        std::vector<std::unique_ptr<uint8_t[]>> framePool;
+        std::vector<uint8_t *> freeFrames;
+        std::deque<std::pair<uint8_t *, uint64_t>> queuedFrames;
+        std::mutex mutex;
+        std::condition_variable frameQueued;
+        std::condition_variable frameReleased;
+        bool stopping;
+        std::thread worker;
+        // the first error seen by the worker, rethrown on the render thread
+        std::exception_ptr workerError;
+    };
+
+    unsigned int width;
+    unsigned int height;
+    size_t frameBytes;
+    uint64_t frameIndex;
+    std::vector<std::unique_ptr<Output>> outputs;
+    std::vector<std::unique_ptr<Group>> groups;
+
+    static size_t yuvFrameBytes(unsigned int width, unsigned int height);
+    static bool wantsFrame(const Group &group, uint64_t index);
+    static void sendToOutputs(const Group &group, const uint8_t *data, uint64_t index);
+    void startGroup(Group &group);
+    void scaleLoop(Group *group);
+};
+
+CaptureFanout::CaptureFanout(unsigned int width, unsigned int height)
+    : width(width), height(height), frameBytes(yuvFrameBytes(width, height)), frameIndex(0)
+{
+}
+
+CaptureFanout::~CaptureFanout()
+{
+    release();
+}
+
+size_t CaptureFanout::yuvFrameBytes(unsigned int width, unsigned int height)
+{
+    return size_t(width) * height + 2 * size_t((width + 1) / 2) * ((height + 1) / 2);
+}
+
+size_t CaptureFanout::addOutput(const CaptureOutput &output)
+{
+    if (frameIndex > 0)
+    {
+        throw std::runtime_error("Capture outputs can not be added after the first frame.");
+    }
+    const unsigned int outputWidth = output.width > 0 ? output.width : width;
+    const unsigned int outputHeight = output.height > 0 ? output.height : height;
+
+    std::unique_ptr<Output> added = std::make_unique<Output>();
+    added->decimation = output.decimation > 0 ? output.decimation : 1;
+    added->capture = std::make_unique<ScreenCapture>(outputWidth, outputHeight, output.frameRate, 0, output.format, output.codec);
+    added->capture->openOutputContext(output.path.c_str());
+    // each output encodes on its own thread, a live stream rather skips a stale frame than lets the delay grow
+    if (output.format == EScreenCaptureFormat_STREAM)
+    {
+        added->capture->enableAsync(2, EScreenCaptureBackpressure_DROP_OLDEST);
+    }
+    else
+    {
+        added->capture->enableAsync();
+    }
+
+    Group *group = nullptr;
+    for (const std::unique_ptr<Group> &existing : groups)
+    {
+        if (existing->width == outputWidth && existing->height == outputHeight)
+        {
+            group = existing.get();
+        }
+    }
+    if (group == nullptr)
+    {
+        groups.push_back(std::make_unique<Group>());
+        group = groups.back().get();
+        group->width = outputWidth;
+        group->height = outputHeight;
+        group->scaler = nullptr;
+        group->stopping = false;
+        if (outputWidth != width || outputHeight != height)
+        {
+            startGroup(*group);
+        }
+    }
+    group->outputs.push_back(added.get());
+    outputs.push_back(std::move(added));
+    return outputs.size() - 1;
+}
+
+void CaptureFanout::startGroup(Group &group)
+{
+    group.scaler = sws_getContext(width, height, AV_PIX_FMT_YUV420P,
+                                  group.width, group.height, AV_PIX_FMT_YUV420P,
+                                  SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!group.scaler)
+    {
+        throw std::runtime_error("Failed to initialize the scaling context.");
+    }
+    group.scaled.resize(yuvFrameBytes(group.width, group.height));
+
+    // one frame being scaled and one waiting, a slower group holds up the render thread instead of piling up frames
+    for (int i = 0; i < 2; i++)
+    {
+        group.framePool.push_back(std::make_unique<uint8_t[]>(frameBytes));
+        group.freeFrames.push_back(group.framePool.back().get());
+    }
+    group.worker = std::thread(&CaptureFanout::scaleLoop, this, &group);
+}
+
+bool CaptureFanout::wantsFrame(const Group &group, uint64_t index)
+{
+    for (const Output *output : group.outputs)
+    {
+        if (index % output->decimation == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CaptureFanout::sendToOutputs(const Group &group, const uint8_t *data, uint64_t index)
+{
+    for (Output *output : group.outputs)
+    {
+        if (index % output->decimation == 0)
+        {
+            output->capture->encodeYUV420Frame(data);
+        }
+    }
+}
+
+void CaptureFanout::submit(const uint8_t *data)
+{
+    const uint64_t index = frameIndex++;
+    for (const std::unique_ptr<Group> &group : groups)
+    {
+        // a frame no output of the group keeps is neither copied nor scaled
+        if (!wantsFrame(*group, index))
+        {
+            continue;
+        }
+        if (!group->scaler)
+        {
+            sendToOutputs(*group, data, index);
+            continue;
+        }
+
+        uint8_t *frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(group->mutex);
+            group->frameReleased.wait(lock, [&]()
+                                      { return !group->freeFrames.empty() || group->workerError; });
+            if (group->workerError)
+            {
+                std::rethrow_exception(group->workerError);
+            }
+            frame = group->freeFrames.back();
+            group->freeFrames.pop_back();
+        }
+        memcpy(frame, data, frameBytes);
+
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->queuedFrames.emplace_back(frame, index);
+        group->frameQueued.notify_one();
+    }
+}
+
+void CaptureFanout::scaleLoop(Group *group)
+{
+    const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    const int scaledChromaWidth = (group->width + 1) / 2, scaledChromaHeight = (group->height + 1) / 2;
+    uint8_t *const scaledPlanes[3] = {
+        group->scaled.data(),
+        group->scaled.data() + size_t(group->width) * group->height,
+        group->scaled.data() + size_t(group->width) * group->height + size_t(scaledChromaWidth) * scaledChromaHeight};
+    const int scaledStrides[3] = {static_cast<int>(group->width), scaledChromaWidth, scaledChromaWidth};
+    const int sourceStrides[3] = {static_cast<int>(width), chromaWidth, chromaWidth};
+
+    while (true)
+    {
+        std::pair<uint8_t *, uint64_t> frame;
+        {
+            std::unique_lock<std::mutex> lock(group->mutex);
+            group->frameQueued.wait(lock, [&]()
+                                    { return group->stopping || !group->queuedFrames.empty(); });
+            // stopping only ends the loop once every queued frame is handed on
+            if (group->queuedFrames.empty())
+            {
+                return;
+            }
+            frame = group->queuedFrames.front();
+            group->queuedFrames.pop_front();
+        }
+
+        try
+        {
+            const uint8_t *sourcePlanes[3] = {
+                frame.first,
+                frame.first + size_t(width) * height,
+                frame.first + size_t(width) * height + size_t(chromaWidth) * chromaHeight};
+            sws_scale(group->scaler, sourcePlanes, sourceStrides, 0, height, scaledPlanes, scaledStrides);
+            sendToOutputs(*group, group->scaled.data(), frame.second);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(group->mutex);
+            group->workerError = std::current_exception();
+            group->frameReleased.notify_all();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->freeFrames.push_back(frame.first);
+        group->frameReleased.notify_all();
+    }
+}
+
+size_t CaptureFanout::outputCount() const
+{
+    return outputs.size();
+}
+
+ScreenCaptureStats CaptureFanout::stats(size_t output) const
+{
+    return outputs.at(output)->capture->stats();
+}
+
+void CaptureFanout::release()
+{
+    for (const std::unique_ptr<Group> &group : groups)
+    {
+        if (group->worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(group->mutex);
+                group->stopping = true;
+            }
+            group->frameQueued.notify_one();
+            group->worker.join();
+        }
+        if (group->scaler)
+        {
+            sws_freeContext(group->scaler);
+            group->scaler = nullptr;
+        }
+    }
+    // drains and closes every encoder, safe to run twice
+    for (const std::unique_ptr<Output> &output : outputs)
+    {
+        output->capture->release();
+    }
+}
+
+#endif
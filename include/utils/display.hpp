@@ -4,13 +4,29 @@
 #include <GLFW/glfw3.h>
 #include <glad/glad.h>
 #include <utils/callback_manager.hpp>
+#include <utils/capture_fanout.hpp>
+#include <utils/image_sequence_capture.hpp>
+#include <utils/pixel_readback.hpp>
 #include <utils/screen_capture.hpp>
+#include <utils/segmented_capture.hpp>
+#include <chrono>
+#include <cmath>
 #include <map>
 #include <memory>
 
 #include <iostream>
 #include <stdexcept>
 
+// headless mode creates its context through EGL where available (mesa llvmpipe on GPU-less linux
+// boxes) and falls back to an invisible GLFW window elsewhere
+#if defined(__linux__)
+#define DISPLAY_HAS_EGL 1
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 struct FrameInfoStruct
 {
     unsigned int width;
@@ -20,6 +36,13 @@ struct FrameInfoStruct
     float time;
 };
 
+enum EDisplayMode
+{
+    EDisplayMode_WINDOW,
+    // no window, every frame is rendered into an offscreen framebuffer
+    EDisplayMode_HEADLESS,
+};
+
 class Display
 {
 public:
@@ -28,13 +51,34 @@ public:
     int framebufferWidth;
     int framebufferHeight;
 
-    Display(unsigned int width = 800, unsigned int height = 600);
+    Display(unsigned int width = 800, unsigned int height = 600, EDisplayMode mode = EDisplayMode_WINDOW);
     ~Display();
+    // render() returns after this many frames, 0 keeps going until the window closes or pause() is called
+    void setFrameLimit(unsigned int frames);
+    // render() returns once this many seconds of frame time have passed, 0 disables the limit
+    void setDurationLimit(float seconds);
+    // offline rendering: frame time advances by exactly 1/frameRate per frame instead of following the clock
+    // and vsync is off, so frames render as fast as the GPU allows and every run produces the same frames.
+    // pass the capture frame rate to get a video that plays back at the intended speed
+    void enableOfflineRendering(unsigned int frameRate);
+    // the framebuffer the render callbacks draw into, demos that bind their own targets restore this instead of 0
+    unsigned int framebuffer() const;
     void on(const char *event, const CallbackManager<FrameInfoStruct>::Callback &callback);
     void render();
     void pause();
     void resume();
+    // record at the framebuffer size, same as addCaptureOutput with width and height 0
     void turnOnCapture(EScreenCaptureFormat format, const char *outputPath, unsigned int frameRate = 24);
+    // every output is fed from the same readback, the frame is read from the GPU once however many are attached.
+    // outputs have to be added before the first captured frame, returns the index for captureStats()
+    size_t addCaptureOutput(const CaptureOutput &output);
+    // for long offline renders: GOP aligned segments are encoded in parallel and joined into outputPath on close
+    void turnOnSegmentedCapture(const char *outputPath, unsigned int frameRate = 24);
+    // lossless numbered images of every frame next to or instead of a video. EXR switches the offscreen
+    // framebuffer to half floats so values above 1 survive, it throws outside headless mode
+    void turnOnImageSequenceCapture(const char *directory, EImageSequenceFormat format = EImageSequenceFormat_PNG);
+    // counters of one capture output, all zero if there is no such output
+    ScreenCaptureStats captureStats(size_t output = 0) const;
     void tunrnDownCapture();
 
 private:
@@ -43,23 +87,79 @@ private:
     float lastFrame;
     unsigned int frame;
     bool shouldPause;
+    EDisplayMode mode;
+    unsigned int frameLimit;
+    float durationLimit;
+    // 0 follows the clock
+    unsigned int offlineFrameRate;
+    std::chrono::steady_clock::time_point startTime;
     GLFWwindow *window;
 
+    // offscreen target used in headless mode
+    unsigned int fbo;
+    unsigned int colorRenderbuffer;
+    unsigned int depthRenderbuffer;
+#ifdef DISPLAY_HAS_EGL
+    EGLDisplay eglDisplay;
+    EGLSurface eglSurface;
+    EGLContext eglContext;
+#endif
+
     // capture
     bool enableCapture;
-    std::unique_ptr<ScreenCapture> screenCapture;
+    std::unique_ptr<CaptureFanout> captureFanout;
+    // a live output wants the shortest readback ring
+    bool liveCapture;
+    std::unique_ptr<SegmentedScreenCapture> segmentedCapture;
+    std::unique_ptr<PixelReadback> readback;
+    std::unique_ptr<ImageSequenceCapture> imageSequence;
+    // RGB24 or float, a second readback since the video one is converted to YUV
+    std::unique_ptr<PixelReadback> imageReadback;
 
     // callbacks
     std::map<const char *, std::unique_ptr<CallbackManager<FrameInfoStruct>>> callbacksMap;
 
+    void createWindow(bool visible);
+    bool createHeadlessContext();
+    void createOffscreenFramebuffer();
+    bool shouldClose() const;
+    float currentTime() const;
     void close();
+    void encodeCapturedFrame(const uint8_t *data);
     static void framebuffer_size_callback(GLFWwindow *window, int width, int height);
     void processInput(GLFWwindow *window);
 };
 
-Display::Display(unsigned int width, unsigned int height)
-    : width(width), height(height), framebufferWidth(0), framebufferHeight(0), deltaTime(0.0), lastFrame(0.0), 
-    frame(0), shouldPause(false), window(nullptr), enableCapture(false), screenCapture(nullptr)
+Display::Display(unsigned int width, unsigned int height, EDisplayMode mode)
+    : width(width), height(height), framebufferWidth(0), framebufferHeight(0), deltaTime(0.0), lastFrame(0.0),
+      frame(0), shouldPause(false), mode(mode), frameLimit(0), durationLimit(0.0f), offlineFrameRate(0), startTime(std::chrono::steady_clock::now()),
+      window(nullptr), fbo(0), colorRenderbuffer(0), depthRenderbuffer(0),
+#ifdef DISPLAY_HAS_EGL
+      eglDisplay(EGL_NO_DISPLAY), eglSurface(EGL_NO_SURFACE), eglContext(EGL_NO_CONTEXT),
+#endif
+      enableCapture(false), captureFanout(nullptr), liveCapture(false), segmentedCapture(nullptr), readback(nullptr),
+      imageSequence(nullptr), imageReadback(nullptr)
+{
+    if (mode == EDisplayMode_HEADLESS && createHeadlessContext())
+    {
+        framebufferWidth = width;
+        framebufferHeight = height;
+    }
+    else
+    {
+        createWindow(mode == EDisplayMode_WINDOW);
+
+        // on retina device, actual framebuffer size may larger than logical size
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    }
+
+    if (mode == EDisplayMode_HEADLESS)
+    {
+        createOffscreenFramebuffer();
+    }
+}
+
+void Display::createWindow(bool visible)
 {
     // glfw: initialize and configure
     // ------------------------------
@@ -67,6 +167,7 @@ Display::Display(unsigned int width, unsigned int height)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
@@ -88,9 +189,94 @@ Display::Display(unsigned int width, unsigned int height)
     {
         throw std::runtime_error("Failed to initialize GLAD.");
     }
+}
+
+// returns false when no EGL implementation can give us a GL 3.3 core context,
+// the caller then falls back to an invisible window
+bool Display::createHeadlessContext()
+{
+#ifdef DISPLAY_HAS_EGL
+    eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, nullptr, nullptr))
+    {
+        // without an X server the default display fails, mesa still offers a surfaceless platform
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        eglDisplay = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+                                        : EGL_NO_DISPLAY;
+        if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, nullptr, nullptr))
+        {
+            eglDisplay = EGL_NO_DISPLAY;
+            return false;
+        }
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE};
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0 ||
+        !eglBindAPI(EGL_OPENGL_API))
+    {
+        eglTerminate(eglDisplay);
+        eglDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    // the pbuffer only makes the context current, frames go to the offscreen framebuffer
+    const EGLint surfaceAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    eglSurface = eglCreatePbufferSurface(eglDisplay, config, surfaceAttributes);
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (eglSurface == EGL_NO_SURFACE || eglContext == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+    {
+        eglTerminate(eglDisplay);
+        eglDisplay = EGL_NO_DISPLAY;
+        eglSurface = EGL_NO_SURFACE;
+        eglContext = EGL_NO_CONTEXT;
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        throw std::runtime_error("Failed to initialize GLAD.");
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Display::createOffscreenFramebuffer()
+{
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, framebufferWidth, framebufferHeight);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+
+    glGenRenderbuffers(1, &depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, framebufferWidth, framebufferHeight);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
-    // on retina device, actual framebuffer size may larger than logical size
-    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        throw std::runtime_error("Offscreen framebuffer is not complete.");
+    }
+    glViewport(0, 0, framebufferWidth, framebufferHeight);
 }
 
 Display::~Display()
@@ -110,12 +296,74 @@ void Display::on(const char *event, const CallbackManager<FrameInfoStruct>::Call
     it->second->registerCallback(callback);
 }
 
+void Display::setFrameLimit(unsigned int frames)
+{
+    frameLimit = frames;
+}
+
+void Display::setDurationLimit(float seconds)
+{
+    durationLimit = seconds;
+}
+
+void Display::enableOfflineRendering(unsigned int frameRate)
+{
+    if (frameRate == 0)
+    {
+        throw std::runtime_error("Offline frame rate must be positive.");
+    }
+    offlineFrameRate = frameRate;
+    if (window != nullptr)
+    {
+        // nothing to wait for, the frames are not meant to be watched live
+        glfwSwapInterval(0);
+    }
+}
+
+unsigned int Display::framebuffer() const
+{
+    return fbo;
+}
+
+bool Display::shouldClose() const
+{
+    if (frameLimit > 0 && frame >= frameLimit)
+    {
+        return true;
+    }
+    if (durationLimit > 0.0f)
+    {
+        // count frames offline, float time would let rounding add or drop the last one
+        if (offlineFrameRate > 0 ? frame >= static_cast<unsigned int>(std::lround(durationLimit * offlineFrameRate))
+                                 : currentTime() >= durationLimit)
+        {
+            return true;
+        }
+    }
+    return window != nullptr && glfwWindowShouldClose(window);
+}
+
+float Display::currentTime() const
+{
+    if (offlineFrameRate > 0)
+    {
+        // derived from the frame index rather than accumulated, so no drift builds up over long renders
+        return static_cast<float>(static_cast<double>(frame) / offlineFrameRate);
+    }
+    if (window != nullptr)
+    {
+        return static_cast<float>(glfwGetTime());
+    }
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - startTime;
+    return elapsed.count();
+}
+
 void Display::render()
 {
-    while (!glfwWindowShouldClose(window) && !shouldPause)
+    while (!shouldClose() && !shouldPause)
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
+        float currentFrame = currentTime();
+        deltaTime = offlineFrameRate > 0 ? 1.0f / offlineFrameRate : currentFrame - lastFrame;
         lastFrame = currentFrame;
         const FrameInfoStruct frameInfo{
             width,
@@ -126,7 +374,10 @@ void Display::render()
         };
         frame++;
 
-        processInput(window);
+        if (mode == EDisplayMode_WINDOW)
+        {
+            processInput(window);
+        }
         // run all the render event
         if (!callbacksMap.empty())
         {
@@ -137,13 +388,61 @@ void Display::render()
             }
         }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // frames reach the encoder a few frames late, close() hands over the ones still in flight
+        if (enableCapture && (captureFanout || segmentedCapture))
+        {
+            if (readback == nullptr)
+            {
+                // every frame the ring holds back is a frame of latency for a live stream
+                readback = std::make_unique<PixelReadback>(framebufferWidth, framebufferHeight, liveCapture ? 2 : 3,
+                                                           EReadbackFormat_YUV420P);
+            }
+            readback->capture([&](const uint8_t *data)
+                              { encodeCapturedFrame(data); });
+        }
+        if (enableCapture && imageSequence)
+        {
+            imageReadback->capture([&](const uint8_t *data)
+                                   { imageSequence->captureFrame(data); });
+        }
+
+        if (mode == EDisplayMode_WINDOW)
+        {
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        else
+        {
+            // nothing is presented, flush so the driver does not queue up frames
+            glFlush();
+        }
     }
 }
 
 void Display::close()
 {
+    if (readback)
+    {
+        readback->flush([&](const uint8_t *data)
+                        { encodeCapturedFrame(data); });
+        readback.reset();
+    }
+    if (imageReadback)
+    {
+        // close() runs from the destructor, a failed image write must not escape it
+        try
+        {
+            imageReadback->flush([&](const uint8_t *data)
+                                 { imageSequence->captureFrame(data); });
+            imageSequence->release();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        imageReadback.reset();
+    }
+
     if (!callbacksMap.empty())
     {
         auto it = callbacksMap.find("close");
@@ -159,6 +458,23 @@ void Display::close()
         }
     }
 
+    if (fbo)
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorRenderbuffer);
+        glDeleteRenderbuffers(1, &depthRenderbuffer);
+    }
+
+#ifdef DISPLAY_HAS_EGL
+    if (eglDisplay != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(eglDisplay, eglContext);
+        eglDestroySurface(eglDisplay, eglSurface);
+        eglTerminate(eglDisplay);
+        return;
+    }
+#endif
     glfwTerminate();
 }
 
@@ -175,20 +491,69 @@ void Display::resume()
 
 void Display::turnOnCapture(EScreenCaptureFormat format, const char *outputPath, unsigned int frameRate)
 {
-    if (screenCapture == nullptr)
+    addCaptureOutput(CaptureOutput{outputPath, format, 0, 0, frameRate, 1, AV_CODEC_ID_H264});
+}
+
+size_t Display::addCaptureOutput(const CaptureOutput &output)
+{
+    if (captureFanout == nullptr)
+    {
+        captureFanout = std::make_unique<CaptureFanout>(framebufferWidth, framebufferHeight);
+    }
+    const size_t index = captureFanout->addOutput(output);
+    liveCapture = liveCapture || output.format == EScreenCaptureFormat_STREAM;
+
+    // render() reads every frame back once all render callbacks ran
+    enableCapture = true;
+    return index;
+}
+
+void Display::turnOnSegmentedCapture(const char *outputPath, unsigned int frameRate)
+{
+    if (segmentedCapture == nullptr)
+    {
+        segmentedCapture = std::make_unique<SegmentedScreenCapture>(outputPath, framebufferWidth, framebufferHeight, frameRate);
+    }
+    enableCapture = true;
+}
+
+void Display::turnOnImageSequenceCapture(const char *directory, EImageSequenceFormat format)
+{
+    if (imageSequence == nullptr)
     {
-        screenCapture = std::make_unique<ScreenCapture>(framebufferWidth, framebufferHeight);
+        if (format != EImageSequenceFormat_PNG)
+        {
+            // a window's default framebuffer is 8 bit, the images would hold clamped values
+            if (!colorRenderbuffer)
+            {
+                throw std::runtime_error("EXR image sequences need headless mode.");
+            }
+            glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16F, framebufferWidth, framebufferHeight);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        }
+        imageSequence = std::make_unique<ImageSequenceCapture>(directory, framebufferWidth, framebufferHeight, format);
+        imageReadback = std::make_unique<PixelReadback>(framebufferWidth, framebufferHeight, 3,
+                                                        ImageSequenceCapture::readbackFormat(format));
     }
-    screenCapture->openOutputContext(outputPath);
+    enableCapture = true;
+}
 
-    on("render",
-       [&](auto _)
-       {
-           uint8_t *data = new uint8_t[framebufferWidth * framebufferHeight * 3];
-           glReadPixels(0, 0, framebufferWidth, framebufferHeight, GL_RGB, GL_UNSIGNED_BYTE, data);
-           screenCapture->encodeFrame(data);
-           delete[] data;
-       });
+ScreenCaptureStats Display::captureStats(size_t output) const
+{
+    return captureFanout && output < captureFanout->outputCount() ? captureFanout->stats(output) : ScreenCaptureStats{};
+}
+
+void Display::encodeCapturedFrame(const uint8_t *data)
+{
+    if (segmentedCapture)
+    {
+        segmentedCapture->encodeYUV420Frame(data);
+    }
+    if (captureFanout)
+    {
+        captureFanout->submit(data);
+    }
 }
 
 void Display::tunrnDownCapture()
@@ -0,0 +1,43 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+const uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+const uint64_t FNV1A_PRIME = 1099511628211ULL;
+
+// 64-bit FNV-1a, pass the previous result as seed to hash data in chunks
+uint64_t fnv1aHash(const void *data, size_t size, uint64_t seed = FNV1A_OFFSET_BASIS)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV1A_PRIME;
+    }
+    return hash;
+}
+
+bool hashFile(const std::string &path, uint64_t &hash)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    hash = FNV1A_OFFSET_BASIS;
+    while (file)
+    {
+        file.read(buffer, sizeof(buffer));
+        hash = fnv1aHash(buffer, static_cast<size_t>(file.gcount()), hash);
+    }
+    return file.eof();
+}
+
+#endif
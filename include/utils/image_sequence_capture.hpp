@@ -0,0 +1,311 @@
+#ifndef IMAGE_SEQUENCE_CAPTURE_H
+#define IMAGE_SEQUENCE_CAPTURE_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+#include <utils/pixel_readback.hpp>
+#include <utils/thread_pool.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum EImageSequenceFormat
+{
+    // 8 bit RGB, lossless
+    EImageSequenceFormat_PNG,
+    // OpenEXR with 16 bit half float channels, enough for HDR compositing at half the size of float.
+    // both EXR formats need a float render target, Display only offers them in headless mode
+    EImageSequenceFormat_EXR_HALF,
+    // OpenEXR with 32 bit float channels
+    EImageSequenceFormat_EXR_FLOAT,
+};
+
+// lossless per-frame output for compositing and golden image comparisons. every frame is compressed as its own
+// task on a thread pool, PNG's deflate is far too slow to keep up on a single core at production resolutions,
+// and a writer thread puts the files on disk strictly in frame order as directory/frame_000000.png and so on.
+// at most two frames per pool thread are in flight, captureFrame waits beyond that.
+class ImageSequenceCapture
+{
+public:
+    ImageSequenceCapture(const std::filesystem::path &directory, unsigned int width, unsigned int height,
+                         EImageSequenceFormat format = EImageSequenceFormat_PNG, ThreadPool &pool = ThreadPool::shared());
+    ~ImageSequenceCapture();
+    ImageSequenceCapture(const ImageSequenceCapture &) = delete;
+    ImageSequenceCapture &operator=(const ImageSequenceCapture &) = delete;
+
+    // the pixels captureFrame expects, RGB24 for PNG and RGB float for EXR
+    static EReadbackFormat readbackFormat(EImageSequenceFormat format);
+
+    // bottom row first as glReadPixels returns it, in the format given by readbackFormat()
+    void captureFrame(const uint8_t *data);
+    // wait until every captured frame is on disk
+    void release();
+    uint64_t writtenFrames() const;
+
+private:
+    std::filesystem::path directory;
+    unsigned int width;
+    unsigned int height;
+    EImageSequenceFormat format;
+    ThreadPool &pool;
+    size_t frameBytes;
+    size_t maxInFlight;
+    uint64_t frameIndex;
+
+    // compressed frames in frame order, the writer waits for the oldest one
+    std::deque<std::pair<uint64_t, std::future<std::vector<uint8_t>>>> pending;
+    size_t inFlight;
+    uint64_t written;
+    mutable std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameWritten;
+    bool stopping;
+    std::thread writer;
+    // the first error seen while compressing or writing, rethrown on the render thread
+    std::exception_ptr writerError;
+
+    std::filesystem::path framePath(uint64_t index) const;
+    std::vector<uint8_t> encodeImage(const std::vector<uint8_t> &pixels) const;
+    void writeLoop();
+};
+
+ImageSequenceCapture::ImageSequenceCapture(const std::filesystem::path &directory, unsigned int width, unsigned int height,
+                                           EImageSequenceFormat format, ThreadPool &pool)
+    : directory(directory), width(width), height(height), format(format), pool(pool),
+      frameBytes(size_t(width) * height * (format == EImageSequenceFormat_PNG ? 3 : 3 * sizeof(float))),
+      maxInFlight(size_t(pool.size()) * 2), frameIndex(0), inFlight(0), written(0), stopping(false)
+{
+    std::filesystem::create_directories(directory);
+    writer = std::thread(&ImageSequenceCapture::writeLoop, this);
+}
+
+ImageSequenceCapture::~ImageSequenceCapture()
+{
+    try
+    {
+        release();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+EReadbackFormat ImageSequenceCapture::readbackFormat(EImageSequenceFormat format)
+{
+    return format == EImageSequenceFormat_PNG ? EReadbackFormat_RGB24 : EReadbackFormat_RGB_FLOAT;
+}
+
+void ImageSequenceCapture::captureFrame(const uint8_t *data)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        frameWritten.wait(lock, [this]()
+                          { return inFlight < maxInFlight || writerError; });
+        if (writerError)
+        {
+            std::rethrow_exception(writerError);
+        }
+        inFlight++;
+    }
+
+    // the readback buffer is unmapped once this returns, the task works on its own copy
+    std::vector<uint8_t> pixels(data, data + frameBytes);
+    std::future<std::vector<uint8_t>> encoded = pool.submit([this, pixels = std::move(pixels)]()
+                                                            { return encodeImage(pixels); });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.emplace_back(frameIndex++, std::move(encoded));
+    frameQueued.notify_one();
+}
+
+uint64_t ImageSequenceCapture::writtenFrames() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+std::filesystem::path ImageSequenceCapture::framePath(uint64_t index) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06llu.%s", static_cast<unsigned long long>(index),
+             format == EImageSequenceFormat_PNG ? "png" : "exr");
+    return directory / name;
+}
+
+std::vector<uint8_t> ImageSequenceCapture::encodeImage(const std::vector<uint8_t> &pixels) const
+{
+    const bool png = format == EImageSequenceFormat_PNG;
+    const AVCodec *codec = avcodec_find_encoder(png ? AV_CODEC_ID_PNG : AV_CODEC_ID_EXR);
+    if (!codec)
+    {
+        throw std::runtime_error("Necessary encoder not found.");
+    }
+    AVCodecContext *context = avcodec_alloc_context3(codec);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    auto cleanup = [&]()
+    {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&context);
+    };
+    if (!context || !frame || !packet)
+    {
+        cleanup();
+        throw std::runtime_error("Failed to allocate the image encoder.");
+    }
+
+    context->width = width;
+    context->height = height;
+    context->time_base = {1, 1};
+    context->pix_fmt = png ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_GBRPF32LE;
+    // every image is already one task of the pool
+    context->thread_count = 1;
+    if (!png)
+    {
+        av_opt_set(context->priv_data, "format", format == EImageSequenceFormat_EXR_HALF ? "half" : "float", 0);
+        av_opt_set(context->priv_data, "compression", "zip16", 0);
+    }
+    frame->format = context->pix_fmt;
+    frame->width = width;
+    frame->height = height;
+    if (avcodec_open2(context, codec, nullptr) < 0 || av_frame_get_buffer(frame, 0) < 0)
+    {
+        cleanup();
+        throw std::runtime_error("Could not open image encoder.");
+    }
+
+    // images are stored top row first
+    if (png)
+    {
+        const int rowBytes = static_cast<int>(width) * 3;
+        av_image_copy_plane(frame->data[0], frame->linesize[0], pixels.data() + size_t(height - 1) * rowBytes, -rowBytes,
+                            rowBytes, height);
+    }
+    else
+    {
+        // interleaved RGB to the planar G, B, R layout of gbrpf32
+        const float *rgb = reinterpret_cast<const float *>(pixels.data());
+        for (unsigned int y = 0; y < height; y++)
+        {
+            const float *source = rgb + size_t(height - 1 - y) * width * 3;
+            float *g = reinterpret_cast<float *>(frame->data[0] + size_t(y) * frame->linesize[0]);
+            float *b = reinterpret_cast<float *>(frame->data[1] + size_t(y) * frame->linesize[1]);
+            float *r = reinterpret_cast<float *>(frame->data[2] + size_t(y) * frame->linesize[2]);
+            for (unsigned int x = 0; x < width; x++)
+            {
+                r[x] = source[x * 3];
+                g[x] = source[x * 3 + 1];
+                b[x] = source[x * 3 + 2];
+            }
+        }
+    }
+
+    std::vector<uint8_t> encoded;
+    if (avcodec_send_frame(context, frame) < 0 || avcodec_send_frame(context, nullptr) < 0)
+    {
+        cleanup();
+        throw std::runtime_error("Error sending an image for encoding.");
+    }
+    while (avcodec_receive_packet(context, packet) == 0)
+    {
+        encoded.insert(encoded.end(), packet->data, packet->data + packet->size);
+        av_packet_unref(packet);
+    }
+    cleanup();
+    if (encoded.empty())
+    {
+        throw std::runtime_error("Image encoder returned no data.");
+    }
+    return encoded;
+}
+
+void ImageSequenceCapture::writeLoop()
+{
+    while (true)
+    {
+        std::pair<uint64_t, std::future<std::vector<uint8_t>>> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameQueued.wait(lock, [this]()
+                             { return stopping || !pending.empty(); });
+            // stopping only ends the loop once every captured frame is written
+            if (pending.empty())
+            {
+                return;
+            }
+            frame = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        try
+        {
+            // later frames may already be compressed, they wait here so files appear in order
+            const std::vector<uint8_t> encoded = frame.second.get();
+            const std::filesystem::path path = framePath(frame.first);
+            std::ofstream file(path, std::ios::binary);
+            if (!file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size()))
+            {
+                throw std::runtime_error("Could not write image " + path.string() + ".");
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writerError = std::current_exception();
+            frameWritten.notify_all();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        inFlight--;
+        written++;
+        frameWritten.notify_all();
+    }
+}
+
+void ImageSequenceCapture::release()
+{
+    if (writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        frameQueued.notify_one();
+        writer.join();
+    }
+    // after an error frames may still be compressing in the pool, they use this object so wait for them
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::pair<uint64_t, std::future<std::vector<uint8_t>>> &frame : pending)
+    {
+        frame.second.wait();
+    }
+    pending.clear();
+    if (writerError)
+    {
+        std::exception_ptr error = writerError;
+        writerError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+#endif
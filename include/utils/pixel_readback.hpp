@@ -0,0 +1,155 @@
+#ifndef PIXEL_READBACK_H
+#define PIXEL_READBACK_H
+
+#include <glad/glad.h>
+#include <utils/yuv_conversion.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+enum EReadbackFormat
+{
+    // 3 bytes per pixel, bottom row first like glReadPixels
+    EReadbackFormat_RGB24,
+    // converted on the GPU, packed Y, U and V planes with the top row first, 1.5 bytes per pixel
+    EReadbackFormat_YUV420P,
+    // 3 floats per pixel, bottom row first, keeps values above 1 when reading a floating point framebuffer
+    EReadbackFormat_RGB_FLOAT,
+};
+
+// asynchronous glReadPixels through a ring of pixel buffer objects. every capture() starts the copy of the
+// current frame into one buffer and hands the frame read `depth` captures earlier to the consumer, by then
+// the GPU has long finished it and mapping does not stall the pipeline. frames arrive tightly packed in
+// the requested format.
+class PixelReadback
+{
+public:
+    using Consumer = std::function<void(const uint8_t *data)>;
+
+    PixelReadback(unsigned int width, unsigned int height, unsigned int depth = 3,
+                  EReadbackFormat format = EReadbackFormat_RGB24);
+    ~PixelReadback();
+    PixelReadback(const PixelReadback &) = delete;
+    PixelReadback &operator=(const PixelReadback &) = delete;
+
+    // read the bound read framebuffer, the consumer may run for an older frame before this returns
+    void capture(const Consumer &consumer);
+    // hand over every frame still in flight, oldest first, call before the last frame is dropped
+    void flush(const Consumer &consumer);
+    size_t pending() const;
+
+private:
+    unsigned int width;
+    unsigned int height;
+    std::unique_ptr<YuvConversionPass> conversion;
+    GLenum pixelType;
+    size_t frameBytes;
+    std::vector<unsigned int> buffers;
+    // index of the buffer the next capture writes into, also the oldest one in flight once the ring is full
+    size_t next;
+    size_t inFlight;
+
+    void consume(unsigned int buffer, const Consumer &consumer);
+};
+
+PixelReadback::PixelReadback(unsigned int width, unsigned int height, unsigned int depth, EReadbackFormat format)
+    : width(width), height(height), pixelType(GL_UNSIGNED_BYTE), frameBytes(size_t(width) * height * 3), next(0), inFlight(0)
+{
+    if (format == EReadbackFormat_RGB_FLOAT)
+    {
+        pixelType = GL_FLOAT;
+        frameBytes = size_t(width) * height * 3 * sizeof(float);
+    }
+    else if (format == EReadbackFormat_YUV420P)
+    {
+        conversion = std::make_unique<YuvConversionPass>(width, height);
+        frameBytes = conversion->frameBytes();
+    }
+
+    // one buffer is not a ring and more than four only adds latency
+    depth = depth < 2 ? 2 : (depth > 4 ? 4 : depth);
+    buffers.resize(depth);
+    glGenBuffers(depth, buffers.data());
+    for (unsigned int buffer : buffers)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+PixelReadback::~PixelReadback()
+{
+    glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+}
+
+void PixelReadback::capture(const Consumer &consumer)
+{
+    if (inFlight == buffers.size())
+    {
+        consume(buffers[next], consumer);
+        inFlight--;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[next]);
+    if (conversion)
+    {
+        conversion->convert(nullptr);
+    }
+    else
+    {
+        GLint packAlignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+        // rows of RGB24 are not 4 byte aligned for every width
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, pixelType, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    next = (next + 1) % buffers.size();
+    inFlight++;
+}
+
+void PixelReadback::flush(const Consumer &consumer)
+{
+    while (inFlight > 0)
+    {
+        consume(buffers[(next + buffers.size() - inFlight) % buffers.size()], consumer);
+        inFlight--;
+    }
+}
+
+size_t PixelReadback::pending() const
+{
+    return inFlight;
+}
+
+void PixelReadback::consume(unsigned int buffer, const Consumer &consumer)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    const uint8_t *data = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes, GL_MAP_READ_BIT));
+    if (!data)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw std::runtime_error("Failed to map pixel pack buffer.");
+    }
+
+    try
+    {
+        consumer(data);
+    }
+    catch (...)
+    {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw;
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+#endif
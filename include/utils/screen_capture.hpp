@@ -7,26 +7,87 @@ extern "C"
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 }
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 enum EScreenCaptureFormat {
     EScreenCaptureFormat_MP4,
+    // live output for remote previews: MPEG-TS, or FLV for rtmp:// and *.flv, to a udp://, tcp:// or file url
+    // (a named pipe works as a file). encoded for latency rather than size, every frame is sent right away
     EScreenCaptureFormat_STREAM,
 };
 
+// frames between two keyframes, every GOP can be decoded on its own
+const int SCREEN_CAPTURE_GOP_SIZE = 10;
+
+// what encodeFrame does in asynchronous mode when the encoder falls behind and the queue is full
+enum EScreenCaptureBackpressure
+{
+    // wait for the encoder, no frame is lost but the render thread stalls
+    EScreenCaptureBackpressure_BLOCK,
+    // throw away the oldest queued frame to make room
+    EScreenCaptureBackpressure_DROP_OLDEST,
+    // throw away the frame being submitted
+    EScreenCaptureBackpressure_DROP_NEWEST,
+};
+
+struct ScreenCaptureStats
+{
+    size_t queueDepth;
+    size_t maxQueueDepth;
+    uint64_t submittedFrames;
+    uint64_t encodedFrames;
+    uint64_t droppedFrames;
+    // STREAM only: time from encodeFrame until the frame's packet was handed to the network or pipe. the
+    // receiver adds transport and decoding on top, the readback adds the frames it holds back
+    double meanLatencyMilliseconds;
+    double maxLatencyMilliseconds;
+};
+
 class ScreenCapture
 {
 public:
-    ScreenCapture(unsigned int width, unsigned int height);
+    // frames are stamped 1/frameRate apart, whatever the time between two encodeFrame calls.
+    // threadCount 0 lets the codec pick its own number of threads
+    ScreenCapture(unsigned int width, unsigned int height, unsigned int frameRate = 30, int threadCount = 0,
+                  EScreenCaptureFormat format = EScreenCaptureFormat_MP4, AVCodecID codecId = AV_CODEC_ID_H264);
     ~ScreenCapture();
     void openOutputContext(const char *filename);
-    void encodeFrame(uint8_t *data);
+    // encode and mux on a worker thread from now on, encodeFrame only copies the frame into a pooled buffer
+    void enableAsync(unsigned int queueCapacity = 4, EScreenCaptureBackpressure backpressure = EScreenCaptureBackpressure_BLOCK);
+    // tightly packed RGB24, bottom row first as glReadPixels returns it
+    void encodeFrame(const uint8_t *data);
+    // tightly packed Y, U and V planes, top row first, e.g. from a YuvConversionPass
+    void encodeYUV420Frame(const uint8_t *data);
+    ScreenCaptureStats stats() const;
     void release();
 
 private:
+    struct QueuedFrame
+    {
+        uint8_t *data;
+        int64_t pts;
+        bool yuv;
+    };
+
+    EScreenCaptureFormat format;
     AVFormatContext *fmt_ctx;
+    const AVCodec *codec;
     AVCodecContext *enc_ctx;
     SwsContext *img_convert_ctx;
     AVFrame *yuv_frame;
@@ -35,14 +96,59 @@ private:
     unsigned int width;
     unsigned int height;
     int64_t frame_counter;
+
+    // asynchronous mode, frames are tightly packed RGB24 copies owned by framePool
+    bool async;
+    EScreenCaptureBackpressure backpressure;
+    size_t queueCapacity;
+    std::vector<std::unique_ptr<uint8_t[]>> framePool;
+    std::vector<uint8_t *> freeFrames;
+    std::deque<QueuedFrame> queuedFrames;
+    mutable std::mutex queueMutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameReleased;
+    bool stopping;
+    std::thread worker;
+    // the first error seen by the worker, rethrown on the render thread
+    std::exception_ptr workerError;
+    size_t maxQueueDepth;
+    uint64_t submittedFrames;
+    std::atomic<uint64_t> encodedFrames;
+    uint64_t droppedFrames;
+
+    // submit time of every frame whose packet has not been sent yet, STREAM only
+    std::deque<std::pair<int64_t, std::chrono::steady_clock::time_point>> submitTimes;
+    uint64_t latencySamples;
+    double latencySumMilliseconds;
+    double latencyMaxMilliseconds;
+
+    void configureStreamEncoder();
+    void recordSubmit(int64_t pts);
+    void recordSent(int64_t pts);
+    void submitFrame(const uint8_t *data, bool yuv);
+    void encodeRGB(const uint8_t *data, int64_t pts);
+    void encodeYUV420(const uint8_t *data, int64_t pts);
+    void sendFrame(int64_t pts);
+    void writePackets();
+    void encodeLoop();
+    void stopAsync();
 };
 
-ScreenCapture::ScreenCapture(unsigned int width, unsigned int height)
-    : fmt_ctx(nullptr), enc_ctx(nullptr), img_convert_ctx(nullptr),
+ScreenCapture::ScreenCapture(unsigned int width, unsigned int height, unsigned int frameRate, int threadCount,
+                             EScreenCaptureFormat format, AVCodecID codecId)
+    : format(format), fmt_ctx(nullptr), codec(nullptr), enc_ctx(nullptr), img_convert_ctx(nullptr),
       yuv_frame(nullptr), pkt(nullptr), out_stream(nullptr),
-      width(width), height(height), frame_counter(0)
+      width(width), height(height), frame_counter(0),
+      async(false), backpressure(EScreenCaptureBackpressure_BLOCK), queueCapacity(0), stopping(false),
+      maxQueueDepth(0), submittedFrames(0), encodedFrames(0), droppedFrames(0),
+      latencySamples(0), latencySumMilliseconds(0.0), latencyMaxMilliseconds(0.0)
 {
-    AVCodec *codec = const_cast<AVCodec *>(avcodec_find_encoder(AV_CODEC_ID_H264));
+    if (frameRate == 0)
+    {
+        throw std::runtime_error("Frame rate must be positive.");
+    }
+
+    codec = avcodec_find_encoder(codecId);
     if (!codec)
     {
         throw std::runtime_error("Necessary encoder not found.");
@@ -58,31 +164,23 @@ ScreenCapture::ScreenCapture(unsigned int width, unsigned int height)
     enc_ctx->width = width;
     enc_ctx->sample_aspect_ratio = {1, 1};
     enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    enc_ctx->time_base = {1, 30};
-    enc_ctx->gop_size = 10;
+    enc_ctx->time_base = {1, static_cast<int>(frameRate)};
+    enc_ctx->framerate = {static_cast<int>(frameRate), 1};
+    enc_ctx->gop_size = SCREEN_CAPTURE_GOP_SIZE;
     enc_ctx->max_b_frames = 1;
-
-    if (avcodec_open2(enc_ctx, codec, nullptr) < 0)
+    enc_ctx->thread_count = threadCount;
+    if (format == EScreenCaptureFormat_STREAM)
     {
-        avcodec_free_context(&enc_ctx);
-        throw std::runtime_error("Could not open encoder.");
+        configureStreamEncoder();
     }
+    // the encoder is opened in openOutputContext, once the container tells whether it wants global headers
 
-    img_convert_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
-                                     width, height, AV_PIX_FMT_YUV420P,
-                                     SWS_BICUBIC, nullptr, nullptr, nullptr);
-
-    if (!img_convert_ctx)
-    {
-        avcodec_free_context(&enc_ctx);
-        throw std::runtime_error("Failed to initialize the conversion context.");
-    }
+    // the RGB to YUV converter is created by the first encodeFrame, YUV420 input never needs it
 
     yuv_frame = av_frame_alloc();
     if (!yuv_frame)
     {
         avcodec_free_context(&enc_ctx);
-        sws_freeContext(img_convert_ctx);
         throw std::runtime_error("Failed to allocate video frame.");
     }
 
@@ -94,16 +192,16 @@ ScreenCapture::ScreenCapture(unsigned int width, unsigned int height)
     {
         av_frame_free(&yuv_frame);
         avcodec_free_context(&enc_ctx);
-        sws_freeContext(img_convert_ctx);
         throw std::runtime_error("Could not allocate raw picture buffer.");
     }
 
     pkt = av_packet_alloc();
     if (!pkt)
     {
+        // the planes come from av_image_alloc, av_frame_free does not own them
+        av_freep(&yuv_frame->data[0]);
         av_frame_free(&yuv_frame);
         avcodec_free_context(&enc_ctx);
-        sws_freeContext(img_convert_ctx);
         throw std::runtime_error("Failed to allocate packet.");
     }
 }
@@ -113,27 +211,74 @@ ScreenCapture::~ScreenCapture()
     release();
 }
 
+void ScreenCapture::configureStreamEncoder()
+{
+    // a viewer can join at any frame: instead of periodic keyframes a column of intra blocks sweeps the picture
+    // once per second, so no single frame is large enough to stall the link
+    enc_ctx->gop_size = enc_ctx->framerate.num;
+    enc_ctx->max_b_frames = 0;
+    // x264 option names, other encoders reject them and keep their defaults
+    av_opt_set(enc_ctx->priv_data, "preset", "veryfast", 0);
+    av_opt_set(enc_ctx->priv_data, "tune", "zerolatency", 0);
+    av_opt_set(enc_ctx->priv_data, "intra-refresh", "1", 0);
+
+    // constant bit rate with a VBV of a single frame, a frame never waits for bits saved up by earlier ones
+    enc_ctx->bit_rate = int64_t(width) * height * enc_ctx->framerate.num / 10;
+    enc_ctx->rc_max_rate = enc_ctx->bit_rate;
+    enc_ctx->rc_buffer_size = static_cast<int>(enc_ctx->bit_rate / enc_ctx->framerate.num);
+}
+
 void ScreenCapture::openOutputContext(const char *path)
 {
-    avformat_alloc_output_context2(&fmt_ctx, nullptr, nullptr, path);
+    const char *formatName = nullptr;
+    if (format == EScreenCaptureFormat_STREAM)
+    {
+        const std::string url(path);
+        const bool flv = url.rfind("rtmp://", 0) == 0 || (url.size() > 4 && url.compare(url.size() - 4, 4, ".flv") == 0);
+        formatName = flv ? "flv" : "mpegts";
+        avformat_network_init();
+    }
+
+    avformat_alloc_output_context2(&fmt_ctx, nullptr, formatName, path);
     if (!fmt_ctx)
     {
         throw std::runtime_error("Could not create output context.");
     }
 
     AVOutputFormat *fmt = const_cast<AVOutputFormat *>(fmt_ctx->oformat);
+    if (fmt->flags & AVFMT_GLOBALHEADER)
+    {
+        enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(enc_ctx, codec, nullptr) < 0)
+    {
+        avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
+        throw std::runtime_error("Could not open encoder.");
+    }
+    if (format == EScreenCaptureFormat_STREAM)
+    {
+        // hand every packet to the protocol as soon as it is written, nothing is held back for interleaving
+        fmt_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        fmt_ctx->max_delay = 0;
+    }
+
     out_stream = avformat_new_stream(fmt_ctx, nullptr);
     if (!out_stream)
     {
         avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
         throw std::runtime_error("Failed to allocate output stream.");
     }
 
-    out_stream->time_base = {1, 30};
+    // the muxer may still pick a finer time base in avformat_write_header, packets are rescaled to it
+    out_stream->time_base = enc_ctx->time_base;
+    out_stream->avg_frame_rate = enc_ctx->framerate;
 
     if (avcodec_parameters_from_context(out_stream->codecpar, enc_ctx) < 0)
     {
         avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
         throw std::runtime_error("Failed to copy encoder parameters to output stream.");
     }
 
@@ -142,73 +287,333 @@ void ScreenCapture::openOutputContext(const char *path)
         if (avio_open(&fmt_ctx->pb, path, AVIO_FLAG_WRITE) < 0)
         {
             avformat_free_context(fmt_ctx);
+            fmt_ctx = nullptr;
             throw std::runtime_error("Could not open output file.");
         }
     }
 
     if (avformat_write_header(fmt_ctx, nullptr) < 0)
     {
-        avio_close(fmt_ctx->pb);
+        // release() must not write a trailer into or close a context that never opened
+        avio_closep(&fmt_ctx->pb);
         avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
         throw std::runtime_error("Error occurred when opening output file.");
     }
 }
 
-void ScreenCapture::encodeFrame(uint8_t *data)
+void ScreenCapture::enableAsync(unsigned int capacity, EScreenCaptureBackpressure mode)
+{
+    if (async)
+    {
+        return;
+    }
+    async = true;
+    backpressure = mode;
+    queueCapacity = capacity > 0 ? capacity : 1;
+
+    // one buffer per queue slot plus the one being filled and the one being encoded, never more
+    const size_t frameBytes = size_t(width) * height * 3;
+    for (size_t i = 0; i < queueCapacity + 2; i++)
+    {
+        framePool.push_back(std::make_unique<uint8_t[]>(frameBytes));
+        freeFrames.push_back(framePool.back().get());
+    }
+    worker = std::thread(&ScreenCapture::encodeLoop, this);
+}
+
+void ScreenCapture::encodeFrame(const uint8_t *data)
+{
+    submitFrame(data, false);
+}
+
+void ScreenCapture::encodeYUV420Frame(const uint8_t *data)
+{
+    submitFrame(data, true);
+}
+
+void ScreenCapture::submitFrame(const uint8_t *data, bool yuv)
+{
+    recordSubmit(frame_counter);
+    if (!async)
+    {
+        if (yuv)
+        {
+            encodeYUV420(data, frame_counter++);
+        }
+        else
+        {
+            encodeRGB(data, frame_counter++);
+        }
+        return;
+    }
+
+    const int64_t pts = frame_counter++;
+    uint8_t *frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (workerError)
+        {
+            std::rethrow_exception(workerError);
+        }
+        submittedFrames++;
+
+        if (queuedFrames.size() >= queueCapacity)
+        {
+            if (backpressure == EScreenCaptureBackpressure_DROP_NEWEST)
+            {
+                // the skipped pts leaves a gap, so the video keeps its timing
+                droppedFrames++;
+                return;
+            }
+            if (backpressure == EScreenCaptureBackpressure_DROP_OLDEST)
+            {
+                freeFrames.push_back(queuedFrames.front().data);
+                queuedFrames.pop_front();
+                droppedFrames++;
+            }
+        }
+        frameReleased.wait(lock, [this]()
+                           { return (!freeFrames.empty() && queuedFrames.size() < queueCapacity) || workerError; });
+        if (workerError)
+        {
+            std::rethrow_exception(workerError);
+        }
+        frame = freeFrames.back();
+        freeFrames.pop_back();
+    }
+
+    // the copy happens outside the lock, the worker keeps encoding meanwhile
+    const size_t chromaBytes = size_t((width + 1) / 2) * ((height + 1) / 2);
+    memcpy(frame, data, yuv ? size_t(width) * height + 2 * chromaBytes : size_t(width) * height * 3);
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queuedFrames.push_back(QueuedFrame{frame, pts, yuv});
+    maxQueueDepth = std::max(maxQueueDepth, queuedFrames.size());
+    frameQueued.notify_one();
+}
+
+ScreenCaptureStats ScreenCapture::stats() const
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return ScreenCaptureStats{queuedFrames.size(), maxQueueDepth, async ? submittedFrames : uint64_t(frame_counter),
+                              encodedFrames.load(), droppedFrames,
+                              latencySamples > 0 ? latencySumMilliseconds / latencySamples : 0.0, latencyMaxMilliseconds};
+}
+
+void ScreenCapture::recordSubmit(int64_t pts)
+{
+    if (format != EScreenCaptureFormat_STREAM)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(queueMutex);
+    submitTimes.emplace_back(pts, std::chrono::steady_clock::now());
+}
+
+// without B-frames packets leave in submission order, entries older than pts belong to dropped frames
+void ScreenCapture::recordSent(int64_t pts)
+{
+    if (format != EScreenCaptureFormat_STREAM)
+    {
+        return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(queueMutex);
+    while (!submitTimes.empty() && submitTimes.front().first < pts)
+    {
+        submitTimes.pop_front();
+    }
+    if (submitTimes.empty() || submitTimes.front().first != pts)
+    {
+        return;
+    }
+    const double latency = std::chrono::duration<double, std::milli>(now - submitTimes.front().second).count();
+    submitTimes.pop_front();
+    latencySamples++;
+    latencySumMilliseconds += latency;
+    latencyMaxMilliseconds = std::max(latencyMaxMilliseconds, latency);
+}
+
+void ScreenCapture::encodeLoop()
+{
+    while (true)
+    {
+        QueuedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            frameQueued.wait(lock, [this]()
+                             { return stopping || !queuedFrames.empty(); });
+            // stopping only ends the loop once every queued frame is written
+            if (queuedFrames.empty())
+            {
+                return;
+            }
+            frame = queuedFrames.front();
+            queuedFrames.pop_front();
+        }
+
+        try
+        {
+            if (frame.yuv)
+            {
+                encodeYUV420(frame.data, frame.pts);
+            }
+            else
+            {
+                encodeRGB(frame.data, frame.pts);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            workerError = std::current_exception();
+            freeFrames.push_back(frame.data);
+            for (const QueuedFrame &queued : queuedFrames)
+            {
+                freeFrames.push_back(queued.data);
+            }
+            queuedFrames.clear();
+            frameReleased.notify_all();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        freeFrames.push_back(frame.data);
+        frameReleased.notify_all();
+    }
+}
+
+void ScreenCapture::stopAsync()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    frameQueued.notify_one();
+    worker.join();
+}
+
+void ScreenCapture::encodeRGB(const uint8_t *data, int64_t pts)
 {
     // Y flip
-    uint8_t *srcSlices[1] = { data + (height - 1) * width * 3 };
+    const uint8_t *srcSlices[1] = { data + (height - 1) * width * 3 };
     int srcStride[1] = { -static_cast<int>(width) * 3};
 
+    if (!img_convert_ctx)
+    {
+        img_convert_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
+                                         width, height, AV_PIX_FMT_YUV420P,
+                                         SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if (!img_convert_ctx)
+        {
+            throw std::runtime_error("Failed to initialize the conversion context.");
+        }
+    }
     sws_scale(img_convert_ctx, srcSlices, srcStride, 0, height, yuv_frame->data, yuv_frame->linesize);
+    sendFrame(pts);
+}
 
-    yuv_frame->pts = frame_counter++;
+void ScreenCapture::encodeYUV420(const uint8_t *data, int64_t pts)
+{
+    // already converted and flipped, only the plane strides differ
+    const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    av_image_copy_plane(yuv_frame->data[0], yuv_frame->linesize[0], data, width, width, height);
+    data += size_t(width) * height;
+    av_image_copy_plane(yuv_frame->data[1], yuv_frame->linesize[1], data, chromaWidth, chromaWidth, chromaHeight);
+    data += size_t(chromaWidth) * chromaHeight;
+    av_image_copy_plane(yuv_frame->data[2], yuv_frame->linesize[2], data, chromaWidth, chromaWidth, chromaHeight);
+    sendFrame(pts);
+}
+
+void ScreenCapture::sendFrame(int64_t pts)
+{
+    yuv_frame->pts = pts;
 
     if (avcodec_send_frame(enc_ctx, yuv_frame) < 0)
     {
         throw std::runtime_error("Error sending a frame for encoding.");
     }
+    writePackets();
+    encodedFrames++;
+}
 
+void ScreenCapture::writePackets()
+{
     while (avcodec_receive_packet(enc_ctx, pkt) == 0)
     {
+        const int64_t pts = pkt->pts;
         av_packet_rescale_ts(pkt, enc_ctx->time_base, out_stream->time_base);
         pkt->stream_index = out_stream->index;
 
-        if (av_interleaved_write_frame(fmt_ctx, pkt) < 0)
+        // a live stream has a single track, interleaving would only buffer packets
+        const int result = format == EScreenCaptureFormat_STREAM ? av_write_frame(fmt_ctx, pkt)
+                                                                 : av_interleaved_write_frame(fmt_ctx, pkt);
+        av_packet_unref(pkt);
+        if (result < 0)
         {
-            av_packet_unref(pkt);
             throw std::runtime_error("Error while writing video frame.");
         }
-        av_packet_unref(pkt);
+        if (format == EScreenCaptureFormat_STREAM)
+        {
+            if (fmt_ctx->pb)
+            {
+                avio_flush(fmt_ctx->pb);
+            }
+            recordSent(pts);
+        }
     }
 }
 
 void ScreenCapture::release()
 {
+    stopAsync();
     if (fmt_ctx)
     {
-        av_write_trailer(fmt_ctx);
-        if (enc_ctx)
+        // drain the frames still held by the encoder before the trailer is written
+        if (enc_ctx && avcodec_send_frame(enc_ctx, nullptr) == 0)
         {
-            avcodec_free_context(&enc_ctx);
-        }
-        if (pkt)
-        {
-            av_packet_free(&pkt);
-        }
-        if (yuv_frame)
-        {
-            av_frame_free(&yuv_frame);
-        }
-        if (img_convert_ctx)
-        {
-            sws_freeContext(img_convert_ctx);
+            try
+            {
+                writePackets();
+            }
+            catch (const std::runtime_error &e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
         }
+        av_write_trailer(fmt_ctx);
         if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE))
         {
             avio_close(fmt_ctx->pb);
         }
         avformat_free_context(fmt_ctx);
+        // the destructor calls release() again
+        fmt_ctx = nullptr;
+    }
+    // the encoder and the conversion state exist from the constructor on, also when no output was opened
+    if (enc_ctx)
+    {
+        avcodec_free_context(&enc_ctx);
+    }
+    if (pkt)
+    {
+        av_packet_free(&pkt);
+    }
+    if (yuv_frame)
+    {
+        // the planes come from av_image_alloc, av_frame_free does not own them
+        av_freep(&yuv_frame->data[0]);
+        av_frame_free(&yuv_frame);
+    }
+    if (img_convert_ctx)
+    {
+        sws_freeContext(img_convert_ctx);
+        img_convert_ctx = nullptr;
     }
 }
 
@@ -0,0 +1,404 @@
+#ifndef SEGMENTED_CAPTURE_H
+#define SEGMENTED_CAPTURE_H
+
+#include <utils/screen_capture.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// raw frames all segments together may hold before the render thread waits for the encoders, 1 GiB
+const size_t SEGMENTED_CAPTURE_QUEUE_BYTES = size_t(1) << 30;
+
+// records one long video as independent GOP aligned segments, each encoded by its own ScreenCapture on its own
+// thread, and losslessly remuxes them into the output file in release(). frames still arrive one by one from the
+// render thread: the segment being filled is encoded while the ones before it finish, so encoding spreads over
+// every core instead of being capped by one encoder. at most maxEncoders segments are in flight, the render
+// thread waits when a new segment would exceed that. raw frames waiting for their encoder are the main memory
+// cost, the render thread also waits while they take more than queueBytes together.
+class SegmentedScreenCapture
+{
+public:
+    // segmentFrames is rounded up to whole GOPs, maxEncoders 0 uses one encoder per core,
+    // queueBytes 0 uses SEGMENTED_CAPTURE_QUEUE_BYTES. a single frame is always accepted
+    SegmentedScreenCapture(const char *outputPath, unsigned int width, unsigned int height, unsigned int frameRate = 30,
+                           unsigned int segmentFrames = 120, unsigned int maxEncoders = 0, size_t queueBytes = 0);
+    ~SegmentedScreenCapture();
+    SegmentedScreenCapture(const SegmentedScreenCapture &) = delete;
+    SegmentedScreenCapture &operator=(const SegmentedScreenCapture &) = delete;
+
+    // tightly packed RGB24, bottom row first as glReadPixels returns it
+    void encodeFrame(const uint8_t *data);
+    // tightly packed Y, U and V planes, top row first, e.g. from a YuvConversionPass
+    void encodeYUV420Frame(const uint8_t *data);
+    // wait for every segment, concatenate them into the output file and remove the segment files
+    void release();
+
+private:
+    struct PendingFrame
+    {
+        std::vector<uint8_t> data;
+        bool yuv;
+    };
+
+    struct Segment
+    {
+        std::string path;
+        std::deque<PendingFrame> frames;
+        unsigned int frameCount;
+        // no more frames will be queued, the worker finishes once it drained the queue
+        bool closed;
+        std::thread worker;
+    };
+
+    std::string outputPath;
+    unsigned int width;
+    unsigned int height;
+    unsigned int frameRate;
+    unsigned int segmentFrames;
+    unsigned int maxEncoders;
+    // codec threads per segment encoder, the segments already keep the cores busy
+    int encoderThreads;
+    bool released;
+
+    std::vector<std::unique_ptr<Segment>> segments;
+    Segment *current;
+    unsigned int runningEncoders;
+    // bytes of raw frames queued or being encoded, over every segment
+    size_t queueBudget;
+    size_t queuedBytes;
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameEncoded;
+    std::condition_variable segmentFinished;
+    // the first error seen by a worker, rethrown on the render thread
+    std::exception_ptr workerError;
+
+    void submitFrame(const uint8_t *data, bool yuv);
+    void startSegment();
+    void closeSegment();
+    void encodeSegment(Segment *segment);
+    void remux();
+    void removeSegmentFiles();
+};
+
+SegmentedScreenCapture::SegmentedScreenCapture(const char *outputPath, unsigned int width, unsigned int height,
+                                               unsigned int frameRate, unsigned int segmentFrames, unsigned int maxEncoders,
+                                               size_t queueBytes)
+    : outputPath(outputPath), width(width), height(height), frameRate(frameRate), released(false), current(nullptr),
+      runningEncoders(0), queueBudget(queueBytes > 0 ? queueBytes : SEGMENTED_CAPTURE_QUEUE_BYTES), queuedBytes(0)
+{
+    if (frameRate == 0)
+    {
+        throw std::runtime_error("Frame rate must be positive.");
+    }
+
+    // every segment has to start on a keyframe, otherwise it can not be decoded after the concatenation
+    const unsigned int gop = SCREEN_CAPTURE_GOP_SIZE;
+    this->segmentFrames = std::max(1u, (segmentFrames + gop - 1) / gop) * gop;
+
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    this->maxEncoders = maxEncoders > 0 ? maxEncoders : cores;
+    encoderThreads = static_cast<int>(std::max(1u, cores / this->maxEncoders));
+}
+
+SegmentedScreenCapture::~SegmentedScreenCapture()
+{
+    try
+    {
+        release();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void SegmentedScreenCapture::encodeFrame(const uint8_t *data)
+{
+    submitFrame(data, false);
+}
+
+void SegmentedScreenCapture::encodeYUV420Frame(const uint8_t *data)
+{
+    submitFrame(data, true);
+}
+
+void SegmentedScreenCapture::submitFrame(const uint8_t *data, bool yuv)
+{
+    if (released)
+    {
+        throw std::runtime_error("Segmented capture is already released.");
+    }
+    if (current == nullptr || current->frameCount == segmentFrames)
+    {
+        startSegment();
+    }
+
+    const size_t chromaBytes = size_t((width + 1) / 2) * ((height + 1) / 2);
+    const size_t frameBytes = yuv ? size_t(width) * height + 2 * chromaBytes : size_t(width) * height * 3;
+    {
+        // rendering usually outpaces the encoders, without a budget the queues would stay nearly full
+        std::unique_lock<std::mutex> lock(mutex);
+        frameEncoded.wait(lock, [&]
+                          { return queuedBytes == 0 || queuedBytes + frameBytes <= queueBudget || workerError; });
+        if (workerError)
+        {
+            std::rethrow_exception(workerError);
+        }
+        current->frames.push_back(PendingFrame{std::vector<uint8_t>(data, data + frameBytes), yuv});
+        current->frameCount++;
+        queuedBytes += frameBytes;
+    }
+    frameQueued.notify_all();
+}
+
+void SegmentedScreenCapture::startSegment()
+{
+    closeSegment();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    segmentFinished.wait(lock, [&]
+                         { return runningEncoders < maxEncoders || workerError; });
+    if (workerError)
+    {
+        std::rethrow_exception(workerError);
+    }
+
+    segments.push_back(std::make_unique<Segment>());
+    current = segments.back().get();
+    current->path = outputPath + ".segment" + std::to_string(segments.size() - 1) + ".mp4";
+    current->frameCount = 0;
+    current->closed = false;
+    runningEncoders++;
+    current->worker = std::thread(&SegmentedScreenCapture::encodeSegment, this, current);
+}
+
+void SegmentedScreenCapture::closeSegment()
+{
+    if (current == nullptr)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current->closed = true;
+    }
+    frameQueued.notify_all();
+    current = nullptr;
+}
+
+void SegmentedScreenCapture::encodeSegment(Segment *segment)
+{
+    try
+    {
+        ScreenCapture capture(width, height, frameRate, encoderThreads);
+        capture.openOutputContext(segment->path.c_str());
+        while (true)
+        {
+            PendingFrame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameQueued.wait(lock, [&]
+                                 { return !segment->frames.empty() || segment->closed || workerError; });
+                if (segment->frames.empty() || workerError)
+                {
+                    break;
+                }
+                frame = std::move(segment->frames.front());
+                segment->frames.pop_front();
+            }
+
+            if (frame.yuv)
+            {
+                capture.encodeYUV420Frame(frame.data.data());
+            }
+            else
+            {
+                capture.encodeFrame(frame.data.data());
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queuedBytes -= frame.data.size();
+            }
+            frameEncoded.notify_all();
+        }
+        capture.release();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!workerError)
+        {
+            workerError = std::current_exception();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        runningEncoders--;
+    }
+    // an error also has to wake the other workers so they stop early
+    frameQueued.notify_all();
+    frameEncoded.notify_all();
+    segmentFinished.notify_all();
+}
+
+void SegmentedScreenCapture::release()
+{
+    if (released)
+    {
+        return;
+    }
+    released = true;
+
+    closeSegment();
+    for (const std::unique_ptr<Segment> &segment : segments)
+    {
+        segment->worker.join();
+    }
+
+    try
+    {
+        if (workerError)
+        {
+            std::rethrow_exception(workerError);
+        }
+        if (!segments.empty())
+        {
+            remux();
+        }
+    }
+    catch (...)
+    {
+        removeSegmentFiles();
+        throw;
+    }
+    removeSegmentFiles();
+}
+
+void SegmentedScreenCapture::remux()
+{
+    AVFormatContext *output = nullptr;
+    avformat_alloc_output_context2(&output, nullptr, nullptr, outputPath.c_str());
+    if (!output)
+    {
+        throw std::runtime_error("Could not create output context.");
+    }
+    AVPacket *packet = av_packet_alloc();
+    AVFormatContext *input = nullptr;
+    AVStream *stream = nullptr;
+
+    auto cleanup = [&]()
+    {
+        if (input)
+        {
+            avformat_close_input(&input);
+        }
+        av_packet_free(&packet);
+        if (stream && !(output->oformat->flags & AVFMT_NOFILE))
+        {
+            avio_close(output->pb);
+        }
+        avformat_free_context(output);
+    };
+
+    try
+    {
+        if (!packet)
+        {
+            throw std::runtime_error("Failed to allocate packet.");
+        }
+
+        int64_t startFrame = 0;
+        for (const std::unique_ptr<Segment> &segment : segments)
+        {
+            if (avformat_open_input(&input, segment->path.c_str(), nullptr, nullptr) < 0 ||
+                avformat_find_stream_info(input, nullptr) < 0 || input->nb_streams == 0)
+            {
+                throw std::runtime_error("Could not open video segment " + segment->path + ".");
+            }
+            AVStream *inputStream = input->streams[0];
+
+            // every segment comes from an identically configured encoder, the first one describes them all
+            if (!stream)
+            {
+                stream = avformat_new_stream(output, nullptr);
+                if (!stream || avcodec_parameters_copy(stream->codecpar, inputStream->codecpar) < 0)
+                {
+                    stream = nullptr;
+                    throw std::runtime_error("Failed to allocate output stream.");
+                }
+                stream->codecpar->codec_tag = 0;
+                stream->time_base = inputStream->time_base;
+                stream->avg_frame_rate = {static_cast<int>(frameRate), 1};
+
+                if (!(output->oformat->flags & AVFMT_NOFILE) && avio_open(&output->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0)
+                {
+                    stream = nullptr;
+                    throw std::runtime_error("Could not open output file.");
+                }
+                if (avformat_write_header(output, nullptr) < 0)
+                {
+                    throw std::runtime_error("Error occurred when opening output file.");
+                }
+            }
+
+            // each segment starts at pts 0, shift it behind the frames of the segments before it
+            const int64_t offset = av_rescale_q(startFrame, {1, static_cast<int>(frameRate)}, inputStream->time_base);
+            while (av_read_frame(input, packet) >= 0)
+            {
+                if (packet->stream_index != inputStream->index)
+                {
+                    av_packet_unref(packet);
+                    continue;
+                }
+                if (packet->pts != AV_NOPTS_VALUE)
+                {
+                    packet->pts += offset;
+                }
+                if (packet->dts != AV_NOPTS_VALUE)
+                {
+                    packet->dts += offset;
+                }
+                av_packet_rescale_ts(packet, inputStream->time_base, stream->time_base);
+                packet->stream_index = stream->index;
+                packet->pos = -1;
+
+                if (av_interleaved_write_frame(output, packet) < 0)
+                {
+                    av_packet_unref(packet);
+                    throw std::runtime_error("Error while writing video frame.");
+                }
+                av_packet_unref(packet);
+            }
+            avformat_close_input(&input);
+            startFrame += segment->frameCount;
+        }
+        av_write_trailer(output);
+    }
+    catch (...)
+    {
+        cleanup();
+        throw;
+    }
+    cleanup();
+}
+
+void SegmentedScreenCapture::removeSegmentFiles()
+{
+    for (const std::unique_ptr<Segment> &segment : segments)
+    {
+        std::remove(segment->path.c_str());
+    }
+}
+
+#endif
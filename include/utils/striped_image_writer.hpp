@@ -0,0 +1,213 @@
+#ifndef STRIPED_IMAGE_WRITER_H
+#define STRIPED_IMAGE_WRITER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// writes an RGB24 image that is too large to hold in memory as a baseline TIFF, one horizontal strip at a time.
+// TIFF keeps the image as independent strips located by a table at the end of the file, so each strip goes
+// straight to disk and only the strip offsets are remembered. the data is uncompressed, which keeps it readable
+// by every TIFF reader and puts the limit at 4GB, roughly 37000 x 37000 pixels.
+class StripedImageWriter
+{
+public:
+    StripedImageWriter(const std::filesystem::path &path, unsigned int width, unsigned int height, unsigned int dpi = 300);
+    ~StripedImageWriter();
+    StripedImageWriter(const StripedImageWriter &) = delete;
+    StripedImageWriter &operator=(const StripedImageWriter &) = delete;
+
+    // tightly packed RGB24 rows, top row first. every strip but the last has the row count of the first one
+    void writeStrip(const uint8_t *rows, unsigned int rowCount);
+    // write the strip table, the image must be complete
+    void finish();
+    unsigned int writtenRows() const;
+
+private:
+    std::ofstream file;
+    unsigned int width;
+    unsigned int height;
+    unsigned int dpi;
+    unsigned int rowsPerStrip;
+    unsigned int rows;
+    std::vector<uint32_t> stripOffsets;
+    std::vector<uint32_t> stripByteCounts;
+    bool finished;
+
+    void writeShort(uint16_t value);
+    void writeLong(uint32_t value);
+    void writeEntry(uint16_t tag, uint16_t type, uint32_t count, uint32_t value);
+    uint32_t position();
+};
+
+StripedImageWriter::StripedImageWriter(const std::filesystem::path &path, unsigned int width, unsigned int height, unsigned int dpi)
+    : width(width), height(height), dpi(dpi), rowsPerStrip(0), rows(0), finished(false)
+{
+    if (width == 0 || height == 0)
+    {
+        throw std::runtime_error("Image size must be positive.");
+    }
+    // pixels, strip table and header have to stay addressable by 32 bit offsets
+    if (uint64_t(width) * height * 3 + uint64_t(height) * 8 + 1024 > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Image is too large for a TIFF file.");
+    }
+    file.open(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open output file " + path.string() + ".");
+    }
+
+    // little endian header, the offset of the directory is patched in by finish()
+    file.write("II", 2);
+    writeShort(42);
+    writeLong(0);
+}
+
+StripedImageWriter::~StripedImageWriter()
+{
+    // an unfinished file has no strip table, it is left behind truncated rather than looking complete
+    file.close();
+}
+
+void StripedImageWriter::writeShort(uint16_t value)
+{
+    const char bytes[2] = {char(value & 0xff), char(value >> 8)};
+    file.write(bytes, 2);
+}
+
+void StripedImageWriter::writeLong(uint32_t value)
+{
+    const char bytes[4] = {char(value & 0xff), char((value >> 8) & 0xff), char((value >> 16) & 0xff), char(value >> 24)};
+    file.write(bytes, 4);
+}
+
+void StripedImageWriter::writeEntry(uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+{
+    writeShort(tag);
+    writeShort(type);
+    writeLong(count);
+    // a single SHORT is stored in the first two bytes of the value field
+    if (type == 3 && count == 1)
+    {
+        writeShort(static_cast<uint16_t>(value));
+        writeShort(0);
+    }
+    else
+    {
+        writeLong(value);
+    }
+}
+
+uint32_t StripedImageWriter::position()
+{
+    return static_cast<uint32_t>(file.tellp());
+}
+
+void StripedImageWriter::writeStrip(const uint8_t *data, unsigned int rowCount)
+{
+    if (finished || rowCount == 0 || rows + rowCount > height)
+    {
+        throw std::runtime_error("Strip does not fit into the image.");
+    }
+    if (rowsPerStrip == 0)
+    {
+        rowsPerStrip = rowCount;
+    }
+    else if (rowCount != rowsPerStrip && rows + rowCount != height)
+    {
+        throw std::runtime_error("Only the last strip may have a different row count.");
+    }
+
+    const uint32_t bytes = width * rowCount * 3;
+    stripOffsets.push_back(position());
+    stripByteCounts.push_back(bytes);
+    if (!file.write(reinterpret_cast<const char *>(data), bytes))
+    {
+        throw std::runtime_error("Error while writing image strip.");
+    }
+    rows += rowCount;
+}
+
+unsigned int StripedImageWriter::writtenRows() const
+{
+    return rows;
+}
+
+void StripedImageWriter::finish()
+{
+    if (finished)
+    {
+        return;
+    }
+    if (rows != height)
+    {
+        throw std::runtime_error("Image is missing strips.");
+    }
+    finished = true;
+
+    // values that do not fit into a directory entry go in front of it, every offset on a word boundary
+    if (position() % 2)
+    {
+        file.put(0);
+    }
+    const uint32_t bitsPerSample = position();
+    writeShort(8);
+    writeShort(8);
+    writeShort(8);
+    file.put(0);
+    file.put(0);
+    const uint32_t resolution = position();
+    writeLong(dpi);
+    writeLong(1);
+    const uint32_t strips = static_cast<uint32_t>(stripOffsets.size());
+    uint32_t offsets = stripOffsets[0], byteCounts = stripByteCounts[0];
+    if (strips > 1)
+    {
+        offsets = position();
+        for (uint32_t offset : stripOffsets)
+        {
+            writeLong(offset);
+        }
+        byteCounts = position();
+        for (uint32_t count : stripByteCounts)
+        {
+            writeLong(count);
+        }
+    }
+
+    // entries sorted by tag, types 3 SHORT, 4 LONG and 5 RATIONAL
+    const uint32_t directory = position();
+    writeShort(13);
+    writeEntry(256, 4, 1, width);
+    writeEntry(257, 4, 1, height);
+    writeEntry(258, 3, 3, bitsPerSample);
+    // no compression
+    writeEntry(259, 3, 1, 1);
+    // RGB
+    writeEntry(262, 3, 1, 2);
+    writeEntry(273, 4, strips, offsets);
+    writeEntry(277, 3, 1, 3);
+    writeEntry(278, 4, 1, rowsPerStrip);
+    writeEntry(279, 4, strips, byteCounts);
+    writeEntry(282, 5, 1, resolution);
+    writeEntry(283, 5, 1, resolution);
+    // chunky RGBRGB samples
+    writeEntry(284, 3, 1, 1);
+    // resolution in inches
+    writeEntry(296, 3, 1, 2);
+    writeLong(0);
+
+    file.seekp(4);
+    writeLong(directory);
+    file.close();
+    if (!file)
+    {
+        throw std::runtime_error("Error while writing image.");
+    }
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef TILED_RENDERER_H
+#define TILED_RENDERER_H
+
+#include <glad/glad.h>
+#include <loader/camera.h>
+#include <utils/pixel_readback.hpp>
+#include <utils/striped_image_writer.hpp>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+// one piece of a tiled image, x and y are the top left corner in image pixels
+struct ImageTile
+{
+    glm::mat4 projection;
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+};
+
+// renders stills far beyond the framebuffer and texture size limits, e.g. 16384 x 16384 for a poster. the image
+// is cut into tiles, each rendered with the camera's projection narrowed to that tile into one framebuffer that
+// is reused for all of them. tiles are read back asynchronously and copied into a strip one tile high, which goes
+// to the writer as soon as its row of tiles is done, so only a single strip is ever held in memory.
+// effects that depend on the screen size, e.g. a post processing pass or gl_FragCoord, see the tile instead.
+class TiledRenderer
+{
+public:
+    using DrawCallback = std::function<void(const ImageTile &tile)>;
+
+    // tiles larger than the driver allows are shrunk
+    TiledRenderer(unsigned int tileWidth = 2048, unsigned int tileHeight = 2048);
+    ~TiledRenderer();
+    TiledRenderer(const TiledRenderer &) = delete;
+    TiledRenderer &operator=(const TiledRenderer &) = delete;
+
+    // draw renders the whole scene with tile.projection into the bound framebuffer, viewport and clear are set up.
+    // the framebuffer binding and viewport are restored afterwards
+    void render(Camera &camera, const std::filesystem::path &path, unsigned int width, unsigned int height,
+                const DrawCallback &draw, float zNear = 0.1f, float zFar = 100.0f);
+
+    unsigned int tileWidth() const;
+    unsigned int tileHeight() const;
+
+private:
+    unsigned int width;
+    unsigned int height;
+    unsigned int fbo;
+    unsigned int colorRenderbuffer;
+    unsigned int depthRenderbuffer;
+    PixelReadback readback;
+
+    static unsigned int maxTileSize(unsigned int requested, int dimension);
+};
+
+unsigned int TiledRenderer::maxTileSize(unsigned int requested, int dimension)
+{
+    GLint renderbufferSize = 0, viewportSize[2] = {0, 0};
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &renderbufferSize);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewportSize);
+    const unsigned int limit = static_cast<unsigned int>(std::min(renderbufferSize, viewportSize[dimension]));
+    return std::max(1u, std::min(requested, limit));
+}
+
+TiledRenderer::TiledRenderer(unsigned int tileWidth, unsigned int tileHeight)
+    : width(maxTileSize(tileWidth, 0)), height(maxTileSize(tileHeight, 1)), fbo(0), colorRenderbuffer(0), depthRenderbuffer(0),
+      readback(width, height, 2)
+{
+    GLint previous;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+
+    glGenRenderbuffers(1, &depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+    if (!complete)
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorRenderbuffer);
+        glDeleteRenderbuffers(1, &depthRenderbuffer);
+        throw std::runtime_error("Tile framebuffer is not complete.");
+    }
+}
+
+TiledRenderer::~TiledRenderer()
+{
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &colorRenderbuffer);
+    glDeleteRenderbuffers(1, &depthRenderbuffer);
+}
+
+unsigned int TiledRenderer::tileWidth() const
+{
+    return width;
+}
+
+unsigned int TiledRenderer::tileHeight() const
+{
+    return height;
+}
+
+void TiledRenderer::render(Camera &camera, const std::filesystem::path &path, unsigned int imageWidth, unsigned int imageHeight,
+                           const DrawCallback &draw, float zNear, float zFar)
+{
+    StripedImageWriter writer(path, imageWidth, imageHeight);
+    // one row of tiles, top row first as the file stores it
+    std::vector<uint8_t> strip(size_t(imageWidth) * height * 3);
+    // tiles whose pixels are still on their way back, oldest first
+    std::deque<ImageTile> reading;
+
+    PixelReadback::Consumer copyTile = [&](const uint8_t *data)
+    {
+        const ImageTile tile = reading.front();
+        reading.pop_front();
+        const size_t rowBytes = size_t(width) * 3;
+        // only the bottom left corner of the framebuffer holds a tile at the right or bottom edge of the image
+        for (unsigned int row = 0; row < tile.height; row++)
+        {
+            memcpy(strip.data() + (size_t(tile.height - 1 - row) * imageWidth + tile.x) * 3, data + row * rowBytes,
+                   size_t(tile.width) * 3);
+        }
+    };
+
+    GLint previousFramebuffer, previousViewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    auto restore = [&]()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    };
+
+    try
+    {
+        for (unsigned int y = 0; y < imageHeight; y += height)
+        {
+            const unsigned int rows = std::min(height, imageHeight - y);
+            for (unsigned int x = 0; x < imageWidth; x += width)
+            {
+                ImageTile tile;
+                tile.x = x;
+                tile.y = y;
+                tile.width = std::min(width, imageWidth - x);
+                tile.height = rows;
+                // the camera measures from the bottom of the image like OpenGL does
+                tile.projection = camera.GetTileProjectionMatrix(imageWidth, imageHeight, x, imageHeight - y - rows,
+                                                                 tile.width, tile.height, zNear, zFar);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+                glViewport(0, 0, tile.width, tile.height);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                draw(tile);
+
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+                reading.push_back(tile);
+                readback.capture(copyTile);
+            }
+            readback.flush(copyTile);
+            writer.writeStrip(strip.data(), rows);
+        }
+        writer.finish();
+    }
+    catch (...)
+    {
+        reading.clear();
+        // the ring must be empty for the next image, the pixels are of no use anymore
+        readback.flush([](const uint8_t *) {});
+        restore();
+        throw;
+    }
+    restore();
+}
+
+#endif
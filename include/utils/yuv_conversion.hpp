@@ -0,0 +1,279 @@
+#ifndef YUV_CONVERSION_H
+#define YUV_CONVERSION_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+// converts the current read framebuffer to BT.601 limited range YUV420P on the GPU, so capture only reads
+// back 1.5 bytes per pixel and the encoder needs no swscale pass. the planes come out top row first,
+// the vertical flip glReadPixels would otherwise need is done while sampling.
+class YuvConversionPass
+{
+public:
+    YuvConversionPass(unsigned int width, unsigned int height);
+    ~YuvConversionPass();
+    YuvConversionPass(const YuvConversionPass &) = delete;
+    YuvConversionPass &operator=(const YuvConversionPass &) = delete;
+
+    // Y, U and V tightly packed one after another, the layout ScreenCapture::encodeYUV420Frame expects
+    size_t frameBytes() const;
+    // convert and read into destination, an offset into the bound GL_PIXEL_PACK_BUFFER when one is bound.
+    // every piece of GL state the pass touches is restored afterwards
+    void convert(uint8_t *destination);
+
+private:
+    unsigned int width;
+    unsigned int height;
+    unsigned int chromaWidth;
+    unsigned int chromaHeight;
+
+    // copy of the frame, the default framebuffer can not be sampled directly
+    unsigned int sourceFbo;
+    unsigned int sourceTexture;
+    unsigned int lumaFbo;
+    unsigned int lumaTexture;
+    // U and V as two attachments written by one draw
+    unsigned int chromaFbo;
+    unsigned int chromaTextures[2];
+
+    unsigned int lumaProgram;
+    unsigned int chromaProgram;
+    unsigned int vao;
+
+    static unsigned int createPlaneTexture(unsigned int width, unsigned int height);
+    static unsigned int compileProgram(const char *fragmentSource);
+};
+
+const char *const YUV_CONVERSION_VERTEX_SOURCE = R"(#version 330 core
+void main()
+{
+    // one triangle covering the whole target
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char *const YUV_CONVERSION_LUMA_SOURCE = R"(#version 330 core
+uniform sampler2D source;
+uniform ivec2 size;
+layout (location = 0) out float luma;
+
+void main()
+{
+    ivec2 target = ivec2(gl_FragCoord.xy);
+    vec3 rgb = texelFetch(source, ivec2(target.x, size.y - 1 - target.y), 0).rgb;
+    luma = dot(rgb, vec3(0.256788, 0.504129, 0.097906)) + 16.0 / 255.0;
+}
+)";
+
+const char *const YUV_CONVERSION_CHROMA_SOURCE = R"(#version 330 core
+uniform sampler2D source;
+uniform ivec2 size;
+layout (location = 0) out float u;
+layout (location = 1) out float v;
+
+vec3 sourceTexel(int x, int row)
+{
+    // row counts from the top, odd sizes repeat the last column/row
+    ivec2 texel = ivec2(min(x, size.x - 1), size.y - 1 - min(row, size.y - 1));
+    return texelFetch(source, texel, 0).rgb;
+}
+
+void main()
+{
+    ivec2 target = ivec2(gl_FragCoord.xy) * 2;
+    vec3 rgb = 0.25 * (sourceTexel(target.x, target.y) + sourceTexel(target.x + 1, target.y) +
+                       sourceTexel(target.x, target.y + 1) + sourceTexel(target.x + 1, target.y + 1));
+    u = dot(rgb, vec3(-0.148223, -0.290993, 0.439216)) + 128.0 / 255.0;
+    v = dot(rgb, vec3(0.439216, -0.367788, -0.071427)) + 128.0 / 255.0;
+}
+)";
+
+YuvConversionPass::YuvConversionPass(unsigned int width, unsigned int height)
+    : width(width), height(height), chromaWidth((width + 1) / 2), chromaHeight((height + 1) / 2)
+{
+    GLint previousFbo;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+
+    glGenTextures(1, &sourceTexture);
+    glBindTexture(GL_TEXTURE_2D, sourceTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenFramebuffers(1, &sourceFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sourceTexture, 0);
+
+    lumaTexture = createPlaneTexture(width, height);
+    glGenFramebuffers(1, &lumaFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, lumaFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lumaTexture, 0);
+
+    chromaTextures[0] = createPlaneTexture(chromaWidth, chromaHeight);
+    chromaTextures[1] = createPlaneTexture(chromaWidth, chromaHeight);
+    glGenFramebuffers(1, &chromaFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, chromaFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, chromaTextures[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, chromaTextures[1], 0);
+    const GLenum chromaBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, chromaBuffers);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!complete)
+    {
+        throw std::runtime_error("YUV conversion framebuffer is not complete.");
+    }
+
+    lumaProgram = compileProgram(YUV_CONVERSION_LUMA_SOURCE);
+    chromaProgram = compileProgram(YUV_CONVERSION_CHROMA_SOURCE);
+    glGenVertexArrays(1, &vao);
+}
+
+YuvConversionPass::~YuvConversionPass()
+{
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(lumaProgram);
+    glDeleteProgram(chromaProgram);
+    glDeleteFramebuffers(1, &sourceFbo);
+    glDeleteFramebuffers(1, &lumaFbo);
+    glDeleteFramebuffers(1, &chromaFbo);
+    glDeleteTextures(1, &sourceTexture);
+    glDeleteTextures(1, &lumaTexture);
+    glDeleteTextures(2, chromaTextures);
+}
+
+size_t YuvConversionPass::frameBytes() const
+{
+    return size_t(width) * height + 2 * size_t(chromaWidth) * chromaHeight;
+}
+
+void YuvConversionPass::convert(uint8_t *destination)
+{
+    GLint drawFbo, readFbo, program, vertexArray, activeTexture, texture, packAlignment, viewport[4];
+    GLboolean colorMask[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFbo);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertexArray);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    const GLenum capabilities[] = {GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_CULL_FACE};
+    GLboolean enabled[5];
+    for (int i = 0; i < 5; i++)
+    {
+        enabled[i] = glIsEnabled(capabilities[i]);
+        glDisable(capabilities[i]);
+    }
+
+    // 1. copy the finished frame into a texture
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sourceFbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    // 2. full resolution luma, then both chroma planes at half resolution
+    glBindVertexArray(vao);
+    glBindTexture(GL_TEXTURE_2D, sourceTexture);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lumaFbo);
+    glViewport(0, 0, width, height);
+    glUseProgram(lumaProgram);
+    glUniform1i(glGetUniformLocation(lumaProgram, "source"), 0);
+    glUniform2i(glGetUniformLocation(lumaProgram, "size"), width, height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, chromaFbo);
+    glViewport(0, 0, chromaWidth, chromaHeight);
+    glUseProgram(chromaProgram);
+    glUniform1i(glGetUniformLocation(chromaProgram, "source"), 0);
+    glUniform2i(glGetUniformLocation(chromaProgram, "size"), width, height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // 3. read the three planes back to back. destination may be a null based pack buffer offset, the
+    // arithmetic is done on integers
+    const uintptr_t luma = reinterpret_cast<uintptr_t>(destination);
+    const uintptr_t u = luma + size_t(width) * height;
+    const uintptr_t v = u + size_t(chromaWidth) * chromaHeight;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, lumaFbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<void *>(luma));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, chromaFbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, chromaWidth, chromaHeight, GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<void *>(u));
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, chromaWidth, chromaHeight, GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<void *>(v));
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUseProgram(program);
+    glBindVertexArray(vertexArray);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glActiveTexture(activeTexture);
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+    glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+    for (int i = 0; i < 5; i++)
+    {
+        if (enabled[i])
+        {
+            glEnable(capabilities[i]);
+        }
+    }
+}
+
+unsigned int YuvConversionPass::createPlaneTexture(unsigned int width, unsigned int height)
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return texture;
+}
+
+unsigned int YuvConversionPass::compileProgram(const char *fragmentSource)
+{
+    int success;
+    char infoLog[512];
+
+    unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex, 1, &YUV_CONVERSION_VERTEX_SOURCE, NULL);
+    glCompileShader(vertex);
+    unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment, 1, &fragmentSource, NULL);
+    glCompileShader(fragment);
+    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
+        std::cout << "ERROR::YUV_CONVERSION::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR::YUV_CONVERSION::LINKING_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    return program;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <loader/shader.h>
+#include <loader/uniform_blocks.hpp>
 #include <loader/camera.h>
 #include <loader/model.hpp>
 
@@ -84,6 +85,10 @@ int main()
     // -------------------------
     Shader asteroidShader((CUR_DIR_PATH / "shaders/vertex2.glsl").c_str(), (CUR_DIR_PATH / "shaders/fragment2.glsl").c_str());
     Shader planetShader((CUR_DIR_PATH / "shaders/vertex3.glsl").c_str(), (CUR_DIR_PATH / "shaders/fragment3.glsl").c_str());
+    Shader::printBinaryCacheStats();
+
+    // projection and view are shared by both programs through the Camera uniform block
+    UniformBuffer<CameraBlock> cameraBuffer(EUniformBlockBinding_CAMERA);
 
     // load models
     // -----------
@@ -178,12 +183,11 @@ int main()
         // configure transformation matrices
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        asteroidShader.use();
-        asteroidShader.setMat4("projection", projection);
-        asteroidShader.setMat4("view", view);
+        cameraBuffer.data.projection = projection;
+        cameraBuffer.data.view = view;
+        cameraBuffer.data.viewPos = camera.Position;
+        cameraBuffer.upload();
         planetShader.use();
-        planetShader.setMat4("projection", projection);
-        planetShader.setMat4("view", view);
 
         // draw planet
         glm::mat4 model = glm::mat4(1.0f);
@@ -200,7 +204,7 @@ int main()
         for (unsigned int i = 0; i < rock.meshes.size(); i++)
         {
             glBindVertexArray(rock.meshes[i].VAO);
-            glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(rock.meshes[i].indices.size()), GL_UNSIGNED_INT, 0, amount);
+            glDrawElementsInstanced(GL_TRIANGLES, rock.meshes[i].indexCount, GL_UNSIGNED_INT, 0, amount);
             glBindVertexArray(0);
         }
 
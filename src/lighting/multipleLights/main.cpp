@@ -2,10 +2,12 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <loader/shader.h>
+#include <loader/uniform_blocks.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #include <loader/camera.h>
 #include <loader/texture.h>
 #include <loader/filesystem.h>
+#include <utils/tiled_renderer.hpp>
 #include <stdlib.h>
 #include <string>
 
@@ -13,12 +15,16 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_click_callback(GLFWwindow *window, int button, int state, int mod);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
-const unsigned int NR_POINT_LIGHT = 4;
+const unsigned int NR_POINT_LIGHT = MAX_POINT_LIGHTS;
+// P saves the current view as a poster, far larger than any framebuffer, rendered in tiles
+const unsigned int POSTER_WIDTH = 16384;
+const unsigned int POSTER_HEIGHT = 12288;
 
 // camera
 Camera camera{glm::vec3(3.0, 3.0, 3.0)};
@@ -37,6 +43,9 @@ float preY = 0.0;
 
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+// F toggles the camera spot light, each state has its own shader variant
+bool flashlight = true;
+bool posterRequested = false;
 
 
 int main()
@@ -66,6 +75,7 @@ int main()
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetMouseButtonCallback(window, mouse_click_callback);
+    glfwSetKeyCallback(window, key_callback);
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
@@ -76,7 +86,10 @@ int main()
     }
 
     // 将shader编译结果链接到一个shader program，前一个shader的输出会作为下一个shader的输入
-    Shader lightingShader("../src/lighting/multipleLights/shaders/vertex1.vs", "../src/lighting/multipleLights/shaders/fragment1.fs");
+    ShaderVariants lightingVariants("../src/lighting/multipleLights/shaders/vertex1.vs", "../src/lighting/multipleLights/shaders/fragment1.fs");
+    const ShaderDefines lightingDefines[2] = {
+        {{"NR_POINT_LIGHTS", std::to_string(NR_POINT_LIGHT)}, {"USE_SPOT_LIGHT", "0"}},
+        {{"NR_POINT_LIGHTS", std::to_string(NR_POINT_LIGHT)}, {"USE_SPOT_LIGHT", "1"}}};
     Shader lightCubeShader("../src/lighting/multipleLights/shaders/vertex2.vs", "../src/lighting/multipleLights/shaders/fragment2.fs");
 
     // 顶点数据
@@ -175,69 +188,72 @@ int main()
     unsigned int diffuseMap = loadTexture("../src/lighting/lightingCasters/images/container2.png");
     unsigned int specularMap = loadTexture("../src/lighting/lightingCasters/images/container2_specular.png");
 
-    lightingShader.use();
-    lightingShader.setInt("material.diffuse", 0);
-    lightingShader.setInt("material.specular", 1);
-    lightingShader.setFloat("material.shininess", 32.0f);
+    for (auto variant = 0; variant < 2; variant++)
+    {
+        Shader &lightingShader = lightingVariants.get(lightingDefines[variant]);
+        lightingShader.use();
+        lightingShader.setInt("material.diffuse", 0);
+        lightingShader.setInt("material.specular", 1);
+        lightingShader.setFloat("material.shininess", 32.0f);
+    }
 
+    // camera and lights live in uniform buffers shared by both programs, one upload each per frame
+    UniformBuffer<CameraBlock> cameraBuffer(EUniformBlockBinding_CAMERA);
+    UniformBuffer<LightsBlock> lightsBuffer(EUniformBlockBinding_LIGHTS);
 
-    // 开启深度测试
-    glEnable(GL_DEPTH_TEST);
+    // direction light
+    LightsBlock &lights = lightsBuffer.data;
+    lights.dirLight.direction = lightDir;
+    lights.dirLight.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
+    lights.dirLight.diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
+    lights.dirLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
 
-    while (!glfwWindowShouldClose(window))
+    // point light
+    for (auto i = 0; i < NR_POINT_LIGHT; i++)
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        PointLightData &light = lights.pointLights[i];
+        light.position = pointLightPositions[0];
+        light.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+        light.diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+        light.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+        light.constant = 1.0f;
+        light.linear = 0.09f;
+        light.quadratic = 0.032f;
+    }
 
-        processInput(window);
+    // spotLight, follows the camera so position and direction are refreshed every frame
+    lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+    lights.spotLight.constant = 1.0f;
+    lights.spotLight.linear = 0.09f;
+    lights.spotLight.quadratic = 0.032f;
+    lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+    lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+
+    // 开启深度测试
+    glEnable(GL_DEPTH_TEST);
 
-        // refresh
+    // 渲染整个场景，投影由调用者给出：窗口用完整的投影，海报每个tile用自己的投影
+    auto drawScene = [&](const glm::mat4 &projection)
+    {
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        Shader &lightingShader = lightingVariants.get(lightingDefines[flashlight]);
         lightingShader.use();
-        lightingShader.setVec3("viewPos", camera.Position);
-
-        // direction light
-        lightingShader.setVec3("dirLight.direction", lightDir);
-        lightingShader.setVec3("dirLight.ambient", 0.2f, 0.2f, 0.2f);
-        lightingShader.setVec3("dirLight.diffuse", 0.5f, 0.5f, 0.5f);
-        lightingShader.setVec3("dirLight.specular", 1.0f, 1.0f, 1.0f);
-
-        // point light
-        for(auto i = 0; i < NR_POINT_LIGHT; i++){
-            std::string curName("pointLights[");
-            curName.append(std::to_string(i));
-            curName.append("].");
-            
-            lightingShader.setVec3((curName + "position").c_str(), pointLightPositions[0]);
-            lightingShader.setVec3((curName + "ambient").c_str(), 0.05f, 0.05f, 0.05f);
-            lightingShader.setVec3((curName + "diffuse").c_str(), 0.8f, 0.8f, 0.8f);
-            lightingShader.setVec3((curName + "specular").c_str(), 1.0f, 1.0f, 1.0f);
-            lightingShader.setFloat((curName + "constant").c_str(), 1.0f);
-            lightingShader.setFloat((curName + "linear").c_str(), 0.09f);
-            lightingShader.setFloat((curName + "quadratic").c_str(), 0.032f);
-        }
 
-        // spotLight
-        lightingShader.setVec3("spotLight.position", camera.Position);
-        lightingShader.setVec3("spotLight.direction", camera.Front);
-        lightingShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-        lightingShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-        lightingShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-        lightingShader.setFloat("spotLight.constant", 1.0f);
-        lightingShader.setFloat("spotLight.linear", 0.09f);
-        lightingShader.setFloat("spotLight.quadratic", 0.032f);
-        lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-        lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));     
+        glm::mat4 view = camera.GetViewMatrix();
+        cameraBuffer.data.projection = projection;
+        cameraBuffer.data.view = view;
+        cameraBuffer.data.viewPos = camera.Position;
+        cameraBuffer.upload();
 
+        lights.spotLight.position = camera.Position;
+        lights.spotLight.direction = camera.Front;
+        lightsBuffer.upload();
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
         glm::mat4 model = glm::mat4(1.0f);
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
         lightingShader.setMat4("model", model);
 
         // bind diffuse map
@@ -262,8 +278,6 @@ int main()
 
         // 渲染light cube
         lightCubeShader.use();
-        lightCubeShader.setMat4("projection", projection);
-        lightCubeShader.setMat4("view", view);
         model = glm::mat4(1.0f);
         model = glm::translate(model, lightPos);
         model = glm::scale(model, glm::vec3(0.4f)); // a smaller cube
@@ -271,6 +285,26 @@ int main()
 
         glBindVertexArray(lightCubeVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+    };
+
+    while (!glfwWindowShouldClose(window))
+    {
+        float currentFrame = static_cast<float>(glfwGetTime());
+        deltaTime = currentFrame - lastFrame;
+        lastFrame = currentFrame;
+
+        processInput(window);
+
+        if (posterRequested)
+        {
+            posterRequested = false;
+            TiledRenderer poster;
+            poster.render(camera, "poster.tif", POSTER_WIDTH, POSTER_HEIGHT, [&](const ImageTile &tile)
+                          { drawScene(tile.projection); });
+            std::cout << "Saved poster.tif" << std::endl;
+        }
+
+        drawScene(camera.GetProjectionMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT));
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -326,6 +360,16 @@ void mouse_click_callback(GLFWwindow *window, int button, int state, int mod)
     }
 }
 
+// glfw: F switches between the shader variants with and without the spot light, P saves a poster
+// ----------------------------------------------------------------------------------------------
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    if (key == GLFW_KEY_F && action == GLFW_PRESS)
+        flashlight = !flashlight;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        posterRequested = true;
+}
+
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
@@ -0,0 +1,7 @@
+// matches CameraBlock in loader/uniform_blocks.hpp
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
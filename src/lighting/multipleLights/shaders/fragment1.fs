@@ -1,6 +1,12 @@
 #version 330 core
 
+// NR_POINT_LIGHTS and USE_SPOT_LIGHT are injected by main.cpp
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 4
+#endif
+#ifndef USE_SPOT_LIGHT
+#define USE_SPOT_LIGHT 1
+#endif
 
 out vec4 FragColor;
 
@@ -10,55 +16,15 @@ struct Material {
     float shininess;
 };
 
-// 方向光
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-// 点光源
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-// 聚光灯
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    float constant;
-    float linear;
-    float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;  
-};
+#include "camera.glsl"
+#include "lights.glsl"
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
 uniform Material material;
 
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight;
-
 
 /** 计算平行光源对着色的影响 */ 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
@@ -86,6 +52,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
     return (ambient + diffuse + specular) * attenuation;
 }
 
+#if USE_SPOT_LIGHT
 // calculates the color when using a spot light.
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
@@ -111,6 +78,7 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
 }
+#endif
 
 
 void main()
@@ -121,7 +89,9 @@ void main()
 
     // phase 1: Directional lighting
     vec3 result = CalcDirLight(dirLight, norm, viewDir);
+#if USE_SPOT_LIGHT
     result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+#endif
     // phase 2: Point lights
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
@@ -0,0 +1,51 @@
+// matches LightsBlock in loader/uniform_blocks.hpp, every vec3 is followed by a float so std140
+// packs both into one 16 byte slot without hidden padding
+
+// 方向光
+struct DirLight {
+    vec3 direction;
+    float padding0;
+
+    vec3 ambient;
+    float padding1;
+    vec3 diffuse;
+    float padding2;
+    vec3 specular;
+    float padding3;
+};
+
+// 点光源
+struct PointLight {
+    vec3 position;
+    float constant;
+
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+    float padding;
+};
+
+// 聚光灯
+struct SpotLight {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+};
+
+// NR_POINT_LIGHTS has to equal MAX_POINT_LIGHTS for the layout to match
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    SpotLight spotLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+};
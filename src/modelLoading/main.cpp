@@ -81,9 +81,10 @@ int main()
     // -------------------------
     Shader ourShader((fs::current_path()/"../src/modelLoading/shaders/vertex.glsl").c_str(), (fs::current_path()/"../src/modelLoading/shaders/fragment.glsl").c_str());
 
-    // load models
+    // load models, textures are decoded in the background and show a placeholder until uploaded
     // -----------
-    Model ourModel((fs::current_path()/"../resources/objects/backpack/backpack.obj").c_str());
+    AsyncTextureLoader textureLoader;
+    Model ourModel((fs::current_path()/"../resources/objects/backpack/backpack.obj").c_str(), false, true, &textureLoader);
 
     
     // draw in wireframe
@@ -103,6 +104,9 @@ int main()
         // -----
         processInput(window);
 
+        // upload textures decoded since the last frame, at most ~2ms worth
+        textureLoader.update(2.0);
+
         // render
         // ------
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
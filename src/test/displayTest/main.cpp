@@ -2,6 +2,8 @@
 #include <iostream>
 #include <loader/shader.h>
 #include <loader/texture.h>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <utils/display.hpp>
 
@@ -9,17 +11,60 @@
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 const float SCALE = 0.9;
+const unsigned int FRAME_RATE = 30;
 
 // path
 const std::filesystem::path CUR_DIR_PATH = std::filesystem::current_path() / "../src/test/displayTest";
 const std::filesystem::path RESOURCES_DIR_PATH = std::filesystem::current_path() / "../resources";
 const std::filesystem::path OUTPUT_DIR_PATH = std::filesystem::current_path() / "../output";
 
-int main()
+// usage: HelloGL [--headless frames] [--offline seconds] [--stream url] [--images directory]
+// headless renders the given number of frames without a window, e.g. on servers without a display
+// offline renders a video of the given length with a fixed time step, as fast as the GPU allows
+// stream also sends a half size live preview next to the recording, e.g. --stream udp://127.0.0.1:1234 watched with
+//   ffplay -fflags nobuffer -flags low_delay udp://127.0.0.1:1234
+// images additionally writes every frame as a numbered PNG into the directory
+int main(int argc, char **argv)
 {
-    Display display(SCR_WIDTH, SCR_HEIGHT);
+    unsigned int headlessFrames = 0;
+    float offlineSeconds = 0.0f;
+    const char *streamUrl = nullptr;
+    const char *imagesDirectory = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            headlessFrames = static_cast<unsigned int>(atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--offline") == 0)
+            offlineSeconds = static_cast<float>(atof(argv[i + 1]));
+        else if (strcmp(argv[i], "--stream") == 0)
+            streamUrl = argv[i + 1];
+        else if (strcmp(argv[i], "--images") == 0)
+            imagesDirectory = argv[i + 1];
+    }
+
+    Display display(SCR_WIDTH, SCR_HEIGHT, headlessFrames > 0 ? EDisplayMode_HEADLESS : EDisplayMode_WINDOW);
+    display.setFrameLimit(headlessFrames);
+    if (offlineSeconds > 0.0f)
+    {
+        display.enableOfflineRendering(FRAME_RATE);
+        display.setDurationLimit(offlineSeconds);
+    }
 
-    display.turnOnCapture(EScreenCaptureFormat_MP4, (OUTPUT_DIR_PATH / "videos/test.mp4").c_str());
+    // 推流时全分辨率录制的同时推送半分辨率、半帧率的实时预览，两者共用一次回读
+    // 离线渲染时分段并行编码，结束时再拼接成一个文件
+    size_t previewOutput = 0;
+    if (streamUrl)
+    {
+        display.turnOnCapture(EScreenCaptureFormat_MP4, (OUTPUT_DIR_PATH / "videos/test.mp4").c_str(), FRAME_RATE);
+        previewOutput = display.addCaptureOutput(CaptureOutput{streamUrl, EScreenCaptureFormat_STREAM, SCR_WIDTH / 2, SCR_HEIGHT / 2,
+                                                               FRAME_RATE / 2, 2, AV_CODEC_ID_H264});
+    }
+    else if (offlineSeconds > 0.0f)
+        display.turnOnSegmentedCapture((OUTPUT_DIR_PATH / "videos/test.mp4").c_str(), FRAME_RATE);
+    else
+        display.turnOnCapture(EScreenCaptureFormat_MP4, (OUTPUT_DIR_PATH / "videos/test.mp4").c_str(), FRAME_RATE);
+    if (imagesDirectory)
+        display.turnOnImageSequenceCapture(imagesDirectory);
 
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
@@ -122,5 +167,12 @@ int main()
 
     display.render();
 
+    if (streamUrl)
+    {
+        const ScreenCaptureStats stats = display.captureStats(previewOutput);
+        std::cout << "stream: " << stats.encodedFrames << " frames sent, " << stats.droppedFrames << " dropped, latency "
+                  << stats.meanLatencyMilliseconds << "ms mean, " << stats.maxLatencyMilliseconds << "ms max" << std::endl;
+    }
+
     return 0;
 }
\ No newline at end of file
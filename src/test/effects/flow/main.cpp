@@ -3,7 +3,11 @@
 #include <iostream>
 #include <loader/shader.h>
 #include <loader/texture.h>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <memory>
+#include <utils/pixel_readback.hpp>
 #include <utils/screen_capture.hpp>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
@@ -13,6 +17,7 @@ void processInput(GLFWwindow *window);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 const float SCALE = 0.9;
+const unsigned int FRAME_RATE = 30;
 
 // timing
 float deltaTime = 0.0f;
@@ -22,8 +27,14 @@ float lastFrame = 0.0f;
 const std::filesystem::path CUR_DIR_PATH = std::filesystem::current_path() / "../src/test/effects/flow";
 const std::filesystem::path RESOURCES_DIR_PATH = std::filesystem::current_path() / "../resources";
 
-int main()
+// usage: HelloGL [--offline seconds]
+// offline renders a video of the given length with a fixed time step instead of following the clock,
+// as fast as the GPU allows and with the same frames on every run
+int main(int argc, char **argv)
 {
+    const bool offline = argc > 2 && strcmp(argv[1], "--offline") == 0;
+    const unsigned int offlineFrames = offline ? static_cast<unsigned int>(atof(argv[2]) * FRAME_RATE + 0.5) : 0;
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -68,8 +79,17 @@ int main()
     TextureInfo bgTextureInfo = loadTexture((RESOURCES_DIR_PATH / "textures/wood.png").c_str(), GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER);
 
     // 录制输出
-    ScreenCapture *screenCapture = new ScreenCapture(SCR_WIDTH, SCR_HEIGHT);
+    ScreenCapture *screenCapture = new ScreenCapture(SCR_WIDTH, SCR_HEIGHT, FRAME_RATE);
     screenCapture->openOutputContext((RESOURCES_DIR_PATH / "videos/test.mp4").c_str());
+    // 编码在独立线程中进行
+    screenCapture->enableAsync();
+    // 在 GPU 上转换为 YUV420 后异步回读，帧会延迟几帧后交给编码器
+    // 回读对象持有 GL 资源，需在 glfwTerminate 之前释放
+    std::unique_ptr<PixelReadback> readback = std::make_unique<PixelReadback>(SCR_WIDTH, SCR_HEIGHT, 3, EReadbackFormat_YUV420P);
+    auto encodeFrame = [&](const uint8_t *data)
+    {
+        screenCapture->encodeYUV420Frame(data);
+    };
 
     // 顶点数据
     float vertices[] = {
@@ -130,11 +150,17 @@ int main()
     ourShader.setInt("textureBg", 1);
     ourShader.setVec2("resolution", textureInfo1.width, textureInfo1.height);
 
+    // 离线渲染不等待垂直同步，时间按固定步长推进
+    if (offline)
+    {
+        glfwSwapInterval(0);
+    }
+
     unsigned int cnt = 0;
-    while (!glfwWindowShouldClose(window))
+    while (!glfwWindowShouldClose(window) && (!offline || cnt < offlineFrames))
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
+        float currentFrame = offline ? static_cast<float>(static_cast<double>(cnt) / FRAME_RATE) : static_cast<float>(glfwGetTime());
+        deltaTime = offline ? 1.0f / FRAME_RATE : currentFrame - lastFrame;
         lastFrame = currentFrame;
 
         cnt++;
@@ -159,23 +185,21 @@ int main()
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
         // capture
-        if (cnt % 2 == 0)
+        // 实时渲染时每两帧录制一帧，离线渲染时每帧都录制
+        if (offline || cnt % 2 == 0)
         {
-            uint8_t *data = new uint8_t[SCR_WIDTH * SCR_HEIGHT * 3];
-            glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, data);
             // 编码并写入数据
             try
             {
-                screenCapture->encodeFrame(data);
+                readback->capture(encodeFrame);
             }
             catch (const std::runtime_error &e)
             {
-                delete[] data;
                 std::cerr << e.what() << std::endl;
+                readback.reset();
                 glfwTerminate();
                 return -1;
             }
-            delete[] data;
         }
 
         glfwSwapBuffers(window);
@@ -186,6 +210,8 @@ int main()
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
 
+    readback->flush(encodeFrame);
+    readback.reset();
     screenCapture->release();
 
     glfwTerminate();
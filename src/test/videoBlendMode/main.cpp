@@ -119,16 +119,17 @@ int main()
     // -------------
     unsigned int floorTexture = loadTexture((RESOURCES_DIR_PATH / "textures/shoe2.png").c_str());
 
-    // video texture
-    unsigned int videoTex;
-    glGenTextures(1, &videoTex);
-    VideoFrameLoader *videoFrameLoader = new VideoFrameLoader((RESOURCES_DIR_PATH / "videos/bubble.mp4").c_str());
+    // video, uploaded as its Y, U and V planes and converted in the shader. with buffer storage the decoder
+    // writes the planes straight into the unpack buffers they are uploaded from
+    VideoFrameLoader *videoFrameLoader = new VideoFrameLoader((RESOURCES_DIR_PATH / "videos/bubble.mp4").c_str(), 4,
+                                                              (GLADloadproc)glfwGetProcAddress);
+    // the clip is a short loop, once it is resident in the plane textures it is not decoded again
+    videoFrameLoader->setLoopCache(64 * 1024 * 1024);
 
     // shader configuration
     // --------------------
     shader.use();
     shader.setInt("texture1", 0);
-    shader.setInt("texture2", 1);
 
     // render loop
     // -----------
@@ -161,19 +162,13 @@ int main()
             shader.setMat4("projection", projection);
             shader.setMat4("model", glm::mat4(1.0f));
             shader.setInt("texture1", 0);
-            shader.setInt("texture2", 1);
-            // video
+            // video, the planes take texture units 1 to 3
             glBindVertexArray(planeVAO);
             if (videoFrameLoader->extractFrame(true))
             {
-                videoFrameLoader->displayFrame(videoTex, 1);
-                glBindTexture(GL_TEXTURE_2D, videoTex);
-            }
-            else
-            {
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, floorTexture);
+                videoFrameLoader->displayPlanes(1);
             }
+            videoFrameLoader->setPlaneUniforms(shader, "video");
 
             // floor
             glBindVertexArray(planeVAO);
@@ -195,6 +190,13 @@ int main()
     glDeleteVertexArrays(1, &planeVAO);
     glDeleteBuffers(1, &planeVBO);
 
+    // underruns are frames the render loop had to wait for, the decode thread did not keep ahead
+    const VideoDecodeStats stats = videoFrameLoader->stats();
+    std::cout << "video: " << stats.decodedFrames << " frames decoded, " << stats.underruns << " underruns, decode "
+              << stats.meanDecodeMilliseconds << "ms mean, " << stats.maxDecodeMilliseconds << "ms max, "
+              << stats.zeroCopyFrames << " uploaded without a copy, " << stats.cachedFrames << " cached" << std::endl;
+    delete videoFrameLoader;
+
     glfwTerminate();
     return 0;
 }
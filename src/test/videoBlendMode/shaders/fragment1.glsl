@@ -3,13 +3,16 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
+#include "video.glsl"
+
 uniform sampler2D texture1;
-uniform sampler2D texture2;
+// the video's planes, converted to RGB in the shader
+uniform VideoPlanes video;
 
 void main()
 {    
     vec4 texColor1 = texture(texture1, TexCoords);
-    vec4 texColor2 = texture(texture2, TexCoords);
+    vec4 texColor2 = sampleVideo(video, TexCoords);
 
     // Screen blending formula
     vec4 blendedColor = 1.0 - (1.0 - texColor1) * (1.0 - texColor2);
@@ -0,0 +1,24 @@
+// matches VideoFrameLoader::setPlaneUniforms in loader/video_frame.hpp
+struct VideoPlanes
+{
+    // texture arrays, the frame is the layer when the loop cache holds the whole clip
+    sampler2DArray y;
+    // U, or the interleaved UV of NV12
+    sampler2DArray u;
+    sampler2DArray v;
+    float layer;
+    bool interleaved;
+    // YCbCr to RGB for the video's color matrix and range
+    mat3 matrix;
+    vec3 offset;
+};
+
+// converts the planes uploaded by VideoFrameLoader::displayPlanes back to RGB
+vec4 sampleVideo(VideoPlanes planes, vec2 uv)
+{
+    vec3 coord = vec3(uv, planes.layer);
+    vec3 yuv;
+    yuv.x = texture(planes.y, coord).r;
+    yuv.yz = planes.interleaved ? texture(planes.u, coord).rg : vec2(texture(planes.u, coord).r, texture(planes.v, coord).r);
+    return vec4(clamp(planes.matrix * (yuv - planes.offset), 0.0, 1.0), 1.0);
+}
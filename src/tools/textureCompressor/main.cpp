@@ -0,0 +1,130 @@
+// offline texture converter: writes a block compressed .ktx2 with a full mip chain next to every input
+// image, which TextureCache and AsyncTextureLoader then pick up instead of the original file.
+// runs purely on the cpu, no window or GL context is created.
+//
+// usage: HelloGL [--bc1|--bc3|--bc5|--auto] [--srgb] image...
+//   --auto (default) picks BC3 for images with non-opaque alpha and BC1 otherwise
+//   --bc5 keeps only red/green, meant for two channel data such as tangent space normals
+
+#include <glad/glad.h>
+#include <loader/ktx2.hpp>
+#include <utils/bc_encoder.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <loader/stb_image.h>
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum EFormatChoice
+{
+    EFormatChoice_AUTO,
+    EFormatChoice_BC1,
+    EFormatChoice_BC3,
+    EFormatChoice_BC5,
+};
+
+bool hasTranslucentTexels(const uint8_t *rgba, int width, int height)
+{
+    for (size_t i = 0; i < size_t(width) * height; i++)
+    {
+        if (rgba[i * 4 + 3] != 255)
+            return true;
+    }
+    return false;
+}
+
+bool convertImage(const std::string &path, EFormatChoice choice, bool srgb)
+{
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 4);
+    if (!data)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return false;
+    }
+
+    EBlockFormat format = EBlockFormat_BC1;
+    if (choice == EFormatChoice_BC3 || (choice == EFormatChoice_AUTO && hasTranslucentTexels(data, width, height)))
+        format = EBlockFormat_BC3;
+    else if (choice == EFormatChoice_BC5)
+        format = EBlockFormat_BC5;
+
+    uint32_t vkFormat = EKtx2Format_BC1_RGB_UNORM;
+    if (format == EBlockFormat_BC3)
+        vkFormat = srgb ? EKtx2Format_BC3_SRGB : EKtx2Format_BC3_UNORM;
+    else if (format == EBlockFormat_BC5)
+        vkFormat = EKtx2Format_BC5_UNORM;
+    else if (srgb)
+        vkFormat = EKtx2Format_BC1_RGB_SRGB;
+
+    // compress every level of the mip chain, down to 1x1
+    std::vector<std::vector<uint8_t>> levels;
+    std::vector<uint8_t> level(data, data + size_t(width) * height * 4);
+    stbi_image_free(data);
+    int levelWidth = width, levelHeight = height;
+    while (true)
+    {
+        levels.push_back(compressImage(level.data(), levelWidth, levelHeight, format));
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        level = downsampleImage(level.data(), levelWidth, levelHeight, levelWidth, levelHeight);
+    }
+
+    const std::string outputPath = ktx2SiblingPath(path);
+    if (!writeKtx2(outputPath, vkFormat, width, height, levels))
+    {
+        std::cout << "ERROR::TEXTURE_COMPRESSOR::WRITE_FAILED " << outputPath << std::endl;
+        return false;
+    }
+    std::cout << path << " -> " << outputPath << " (" << width << "x" << height << ", " << levels.size() << " levels)" << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    EFormatChoice choice = EFormatChoice_AUTO;
+    bool srgb = false;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bc1") == 0)
+            choice = EFormatChoice_BC1;
+        else if (strcmp(argv[i], "--bc3") == 0)
+            choice = EFormatChoice_BC3;
+        else if (strcmp(argv[i], "--bc5") == 0)
+            choice = EFormatChoice_BC5;
+        else if (strcmp(argv[i], "--auto") == 0)
+            choice = EFormatChoice_AUTO;
+        else if (strcmp(argv[i], "--srgb") == 0)
+            srgb = true;
+        else
+            inputs.push_back(argv[i]);
+    }
+    if (inputs.empty())
+    {
+        std::cout << "usage: " << argv[0] << " [--bc1|--bc3|--bc5|--auto] [--srgb] image..." << std::endl;
+        return -1;
+    }
+
+    // images are independent, convert them all at once
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<bool>> results;
+    for (const std::string &input : inputs)
+    {
+        results.push_back(std::async(std::launch::async, convertImage, input, choice, srgb));
+    }
+    int failures = 0;
+    for (std::future<bool> &result : results)
+    {
+        failures += result.get() ? 0 : 1;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << inputs.size() - failures << "/" << inputs.size() << " converted in " << elapsed.count() << "s" << std::endl;
+
+    return failures == 0 ? 0 : -1;
+}